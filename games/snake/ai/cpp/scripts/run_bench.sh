@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+ROOT_DIR="$(cd "$SCRIPT_DIR/.." && pwd)"
+BUILD_DIR="${BUILD_DIR:-$ROOT_DIR/build}"
+CONFIG="${CONFIG:-$ROOT_DIR/config/config_paper_20x20.yaml}"
+MIN_TIME="${MIN_TIME:-0.5}"
+FILTER="${FILTER:-}"
+# Un JSON por commit para comparar regresiones en la misma máquina.
+LABEL="${LABEL:-$(git -C "$ROOT_DIR" rev-parse --short HEAD 2>/dev/null || echo local)}"
+OUT="${OUT:-$ROOT_DIR/bench_${LABEL}.json}"
+
+ARGS=(
+  --config "$CONFIG"
+  --min_time "$MIN_TIME"
+  --label "$LABEL"
+  --out "$OUT"
+)
+[ -n "$FILTER" ] && ARGS+=(--filter "$FILTER")
+
+"$BUILD_DIR/alphasnake_bench" "${ARGS[@]}"
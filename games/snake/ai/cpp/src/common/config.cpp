@@ -6,6 +6,8 @@
 #include <sstream>
 #include <unordered_map>
 
+#include "env/snake_env.hpp"
+
 namespace alphasnake {
 namespace {
 
@@ -105,6 +107,18 @@ bool load_config_file(const std::string& path, TrainConfig& cfg, std::string& er
       return true;
     };
 
+    auto set_bool = [&](bool& target) {
+      if (value == "true" || value == "1") {
+        target = true;
+      } else if (value == "false" || value == "0") {
+        target = false;
+      } else {
+        error = "Valor invalido en linea " + std::to_string(lineno) + ": " + full;
+        return false;
+      }
+      return true;
+    };
+
     if (full == "env.board_size" || full == "board_size") {
       if (!set_int(cfg.board_size)) return false;
     } else if (full == "env.max_steps" || full == "max_steps") {
@@ -125,6 +139,24 @@ bool load_config_file(const std::string& path, TrainConfig& cfg, std::string& er
       if (!set_int(cfg.temp_decay_move)) return false;
     } else if (full == "mcts.food_samples" || full == "food_samples") {
       if (!set_int(cfg.food_samples)) return false;
+    } else if (full == "mcts.reuse_tree" || full == "reuse_tree") {
+      if (!set_bool(cfg.reuse_tree)) return false;
+    } else if (full == "mcts.leaf_batch" || full == "leaf_batch_size") {
+      if (!set_int(cfg.leaf_batch_size)) return false;
+    } else if (full == "mcts.transpositions" || full == "transpositions") {
+      if (!set_bool(cfg.transpositions)) return false;
+    } else if (full == "mcts.solver" || full == "solver") {
+      if (!set_bool(cfg.solver)) return false;
+    } else if (full == "mcts.gumbel" || full == "gumbel") {
+      if (!set_bool(cfg.gumbel)) return false;
+    } else if (full == "mcts.gumbel_k" || full == "gumbel_k") {
+      if (!set_int(cfg.gumbel_k)) return false;
+    } else if (full == "mcts.time_us" || full == "search_time_us") {
+      if (!set_int(cfg.search_time_us)) return false;
+    } else if (full == "mcts.nn_budget" || full == "search_nn_budget") {
+      if (!set_int(cfg.search_nn_budget)) return false;
+    } else if (full == "mcts.early_stop" || full == "early_stop") {
+      if (!set_bool(cfg.early_stop)) return false;
     } else if (full == "train.lr" || full == "lr") {
       if (!set_float(cfg.lr)) return false;
     } else if (full == "train.weight_decay" || full == "weight_decay") {
@@ -135,8 +167,24 @@ bool load_config_file(const std::string& path, TrainConfig& cfg, std::string& er
       if (!set_int(cfg.batch_size)) return false;
     } else if (full == "train.buffer" || full == "buffer_size") {
       if (!set_size(cfg.buffer_size)) return false;
+    } else if (full == "train.replay_shards" || full == "replay_shards") {
+      if (!set_int(cfg.replay_shards)) return false;
     } else if (full == "train.epochs" || full == "epochs_per_iter") {
       if (!set_int(cfg.epochs_per_iter)) return false;
+    } else if (full == "train.prefetch_batches" || full == "prefetch_batches") {
+      if (!set_int(cfg.prefetch_batches)) return false;
+    } else if (full == "train.prefetch_loaders" || full == "prefetch_loaders") {
+      if (!set_int(cfg.prefetch_loaders)) return false;
+    } else if (full == "train.pipeline" || full == "pipeline") {
+      if (!set_bool(cfg.pipeline)) return false;
+    } else if (full == "train.sample_ratio" || full == "sample_ratio") {
+      if (!set_float(cfg.sample_ratio)) return false;
+    } else if (full == "train.prioritized" || full == "prioritized_replay") {
+      if (!set_bool(cfg.prioritized_replay)) return false;
+    } else if (full == "train.priority_alpha" || full == "priority_alpha") {
+      if (!set_float(cfg.priority_alpha)) return false;
+    } else if (full == "train.priority_beta" || full == "priority_beta") {
+      if (!set_float(cfg.priority_beta)) return false;
     } else if (full == "selfplay.games" || full == "games_per_iter") {
       if (!set_int(cfg.games_per_iter)) return false;
     } else if (full == "eval.games" || full == "eval_games") {
@@ -145,10 +193,22 @@ bool load_config_file(const std::string& path, TrainConfig& cfg, std::string& er
       if (!set_float(cfg.accept_threshold)) return false;
     } else if (full == "selfplay.workers" || full == "selfplay_workers") {
       if (!set_int(cfg.selfplay_workers)) return false;
+    } else if (full == "selfplay.games_per_thread" || full == "selfplay_games_per_thread") {
+      if (!set_int(cfg.selfplay_games_per_thread)) return false;
+    } else if (full == "selfplay.full_search_prob" || full == "full_search_prob") {
+      if (!set_float(cfg.full_search_prob)) return false;
+    } else if (full == "selfplay.fast_simulations" || full == "fast_simulations") {
+      if (!set_int(cfg.fast_simulations)) return false;
+    } else if (full == "selfplay.fast_value_targets" || full == "fast_value_targets") {
+      if (!set_bool(cfg.fast_value_targets)) return false;
     } else if (full == "selfplay.inference_batch_size" || full == "inference_batch_size") {
       if (!set_int(cfg.inference_batch_size)) return false;
     } else if (full == "selfplay.inference_wait_us" || full == "inference_wait_us") {
       if (!set_int(cfg.inference_wait_us)) return false;
+    } else if (full == "selfplay.inference_latency_cap_us" || full == "inference_latency_cap_us") {
+      if (!set_int(cfg.inference_latency_cap_us)) return false;
+    } else if (full == "selfplay.prediction_cache" || full == "prediction_cache_entries") {
+      if (!set_int(cfg.prediction_cache_entries)) return false;
     } else if (full == "train.iterations" || full == "iterations") {
       if (!set_int(cfg.iterations)) return false;
     } else if (full == "seed") {
@@ -164,6 +224,20 @@ bool load_config_file(const std::string& path, TrainConfig& cfg, std::string& er
     }
   }
 
+  if (cfg.board_size < 3 || cfg.board_size > kMaxBoardSize) {
+    error = "env.board_size fuera de rango [3, " + std::to_string(kMaxBoardSize) +
+            "]: " + std::to_string(cfg.board_size);
+    return false;
+  }
+
+  // Con un buffer más chico que el batch los loaders nunca arman un batch
+  // completo y el learner espera para siempre.
+  if (cfg.batch_size < 1 || cfg.buffer_size < static_cast<std::size_t>(cfg.batch_size)) {
+    error = "train.batch_size fuera de rango [1, train.buffer = " + std::to_string(cfg.buffer_size) +
+            "]: " + std::to_string(cfg.batch_size);
+    return false;
+  }
+
   return true;
 }
 
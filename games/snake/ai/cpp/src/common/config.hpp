@@ -15,21 +15,81 @@ struct TrainConfig {
   float dirichlet_alpha = 0.03f;
   float dirichlet_eps = 0.25f;
   int temp_decay_move = 60;
+  // Comidas muestreadas por nodo de azar del MCTS (máx. 4; 1 = seguir la
+  // comida que sale en step, sin nodos de azar).
   int food_samples = 4;
+  // Reusar el subárbol del movimiento jugado entre búsquedas consecutivas.
+  bool reuse_tree = true;
+  // Hojas evaluadas por llamada batch con virtual loss (1 = MCTS secuencial).
+  int leaf_batch_size = 1;
+  // Tabla de transposiciones: posiciones iguales alcanzadas por distintos
+  // órdenes de jugadas comparten nodo (estadísticas y una sola expansión).
+  bool transpositions = false;
+  // Expandir solo jugadas que sobreviven el próximo paso y propagar
+  // victorias/derrotas demostradas (MCTS-solver).
+  bool solver = true;
+  // Búsqueda Gumbel en la raíz (Gumbel MuZero): top-k por ruido Gumbel,
+  // sequential halving y objetivo de política con Q completada. Pensada para
+  // pocas simulaciones (16-32). gumbel_k = jugadas consideradas en la raíz.
+  bool gumbel = false;
+  int gumbel_k = 4;
+  // Búsqueda anytime: num_simulations pasa a ser un tope (sigue dimensionando
+  // la arena) y se corta antes al agotar el tiempo (us) o los estados de red
+  // por movimiento (0 = sin límite). early_stop corta las búsquedas greedy (temperatura 0) cuando la
+  // jugada más visitada ya no puede cambiar.
+  int search_time_us = 0;
+  int search_nn_budget = 0;
+  bool early_stop = false;
 
   float lr = 1e-3f;
   float weight_decay = 1e-4f;
   float gamma = 0.99f;
   int batch_size = 128;
   std::size_t buffer_size = 500000;
+  // Shards del replay buffer (lock propio cada uno): self-play inserta los
+  // juegos a medida que terminan sin frenar al que muestrea.
+  int replay_shards = 16;
   int epochs_per_iter = 10;
+  // Prefetch de batches: prefetch_loaders hilos arman hasta prefetch_batches
+  // batches por adelantado (tensores reusados, pinned en CUDA) mientras corre
+  // el paso de optimización. 0 loaders = armar el batch en el hilo de train.
+  int prefetch_batches = 3;
+  int prefetch_loaders = 1;
+  // Pipeline asíncrono: self-play continuo contra el último best, learner
+  // entrenando en paralelo a sample_ratio ejemplos entrenados por ejemplo
+  // insertado y evaluación/checkpoint en segundo plano. Una iteración pasa a
+  // ser cada games_per_iter juegos terminados. false = loop serial.
+  bool pipeline = false;
+  float sample_ratio = 8.0f;
+  // Replay priorizado (sum-tree): muestrear por loss^alpha y corregir el
+  // sesgo con pesos de importance sampling (N * P)^-beta. false = uniforme.
+  bool prioritized_replay = false;
+  float priority_alpha = 0.6f;
+  float priority_beta = 0.4f;
 
   int games_per_iter = 500;
   int eval_games = 100;
   float accept_threshold = 0.55f;
   int selfplay_workers = 64;
+  // > 0: self-play con un hilo por core y esta cantidad de juegos en vuelo
+  // por hilo (MCTS reanudable, sin InferenceBatcher). 0 = un hilo por juego.
+  int selfplay_games_per_thread = 0;
+  // Playout cap randomization (KataGo): cada jugada recibe la búsqueda
+  // completa con esta probabilidad y deja objetivo de política; las demás
+  // usan fast_simulations (0 = num_simulations / 8) sin ruido en la raíz y
+  // solo avanzan el juego. fast_value_targets = guardarlas igual como
+  // ejemplos de solo valor. 1.0 = todas completas.
+  float full_search_prob = 1.0f;
+  int fast_simulations = 0;
+  bool fast_value_targets = true;
   int inference_batch_size = 256;
   int inference_wait_us = 800;
+  // > 0: InferenceBatcher ajusta solo batch y deadline (batch_size y wait_us
+  // quedan como topes) manteniendo la latencia por pedido bajo este valor.
+  int inference_latency_cap_us = 20000;
+  // Entradas del cache de predicciones por hash de posición (~40 B c/u),
+  // compartido por self-play y eval. 0 = sin cache.
+  int prediction_cache_entries = 1 << 20;
   int iterations = 200;
 
   int seed = 42;
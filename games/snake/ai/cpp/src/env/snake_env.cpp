@@ -1,6 +1,7 @@
 #include "env/snake_env.hpp"
 
 #include <algorithm>
+#include <type_traits>
 
 namespace alphasnake {
 namespace {
@@ -33,12 +34,68 @@ float direction_value(int action) {
   }
 }
 
+// Planos 4xNxN de encode_state a partir de la forma empaquetada; lo comparten
+// el entorno y la decodificación de ejemplos guardados.
+template <int kBoard>
+void write_planes(int board_size, const uint64_t* occupancy, int head, int food, int direction, float* st) {
+  const int n = kBoard > 0 ? kBoard : board_size;
+  const int size = n * n;
+
+  // Canal 0: cuerpo de la serpiente (leer el bitboard directamente).
+  for (int i = 0; i < size; ++i) {
+    st[static_cast<std::size_t>(i)] = static_cast<float>((occupancy[i >> 6] >> (i & 63)) & 1ULL);
+  }
+
+  // Canales 1 y 2 son one-hot: limpiar antes (el buffer puede venir reusado).
+  std::fill(st + size, st + 3 * size, 0.0f);
+
+  // Canal 1: cabeza.
+  if (head >= 0 && head < size) {
+    st[static_cast<std::size_t>(size + head)] = 1.0f;
+  }
+
+  // Canal 2: comida.
+  st[static_cast<std::size_t>(2 * size + food)] = 1.0f;
+
+  // Canal 3: dirección (constante en todo el tablero).
+  const float dir_val = direction_value(direction);
+  std::fill(st + 3 * size, st + 4 * size, dir_val);
+}
+
+// Claves Zobrist fijas (splitmix64), generadas en compilación: cuerpo,
+// cabeza y comida por celda, más una por dirección.
+constexpr int kZobristBody = 0;
+constexpr int kZobristHead = kMaxCells;
+constexpr int kZobristFood = 2 * kMaxCells;
+constexpr int kZobristDir = 3 * kMaxCells;
+
+constexpr std::array<uint64_t, 3 * kMaxCells + 4> make_zobrist_keys() {
+  std::array<uint64_t, 3 * kMaxCells + 4> keys{};
+  uint64_t x = 0x5A0B5EEDULL;
+  for (auto& k : keys) {
+    x += 0x9E3779B97F4A7C15ULL;
+    uint64_t z = x;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    k = z ^ (z >> 31);
+  }
+  return keys;
+}
+
+constexpr std::array<uint64_t, 3 * kMaxCells + 4> kZobrist = make_zobrist_keys();
+
+uint64_t zobrist(int base, int i) {
+  return kZobrist[static_cast<std::size_t>(base + i)];
+}
+
 }  // namespace
 
+// MCTS copia el entorno en cada nodo: debe seguir siendo un memcpy plano.
+static_assert(std::is_trivially_copyable_v<SnakeEnv>, "SnakeEnv debe copiarse sin asignaciones");
+
 SnakeEnv::SnakeEnv(int board_size, int max_steps, uint32_t seed)
-    : board_size_(board_size),
+    : board_size_(std::max(3, std::min(board_size, kMaxBoardSize))),
       max_steps_(max_steps),
-      grid_(static_cast<std::size_t>(board_size * board_size), 0),
       rng_(seed) {
   reset(seed);
 }
@@ -49,24 +106,40 @@ void SnakeEnv::reset(uint32_t seed) {
 }
 
 void SnakeEnv::reset() {
+  dispatch_board_size(board_size_, [this](auto b) { reset_board<decltype(b)::value>(); });
+}
+
+template <int kBoard>
+void SnakeEnv::reset_board() {
   done_ = false;
   won_ = false;
   steps_ = 0;
   steps_since_food_ = 0;
   direction_ = 3;
 
-  snake_.clear();
-  std::fill(grid_.begin(), grid_.end(), static_cast<uint8_t>(0));
+  body_head_ = 0;
+  body_len_ = 0;
+  occupancy_.fill(0);
+  // La comida anterior sigue "dentro" del hash hasta que spawn_food la reemplace.
+  hash_ = zobrist(kZobristDir, direction_) ^ zobrist(kZobristFood, cell_index<kBoard>(food_));
+
+  const int n = board<kBoard>();
+  free_count_ = n * n;
+  for (int c = 0; c < n * n; ++c) {
+    free_[static_cast<std::size_t>(c)] = static_cast<uint16_t>(c);
+    free_pos_[static_cast<std::size_t>(c)] = static_cast<uint16_t>(c);
+  }
 
-  const int cx = board_size_ / 2;
-  const int cy = board_size_ / 2;
-  snake_.push_back({cx, cy});
-  snake_.push_back({cx - 1, cy});
-  snake_.push_back({cx - 2, cy});
+  // push_front en orden cola→cabeza para dejar la cabeza en (cx, cy).
+  const int cx = n / 2;
+  const int cy = n / 2;
+  body_push_front<kBoard>({cx - 2, cy});
+  body_push_front<kBoard>({cx - 1, cy});
+  body_push_front<kBoard>({cx, cy});
 
-  grid_set({cx, cy}, 1);
-  grid_set({cx - 1, cy}, 1);
-  grid_set({cx - 2, cy}, 1);
+  grid_set<kBoard>({cx, cy}, 1);
+  grid_set<kBoard>({cx - 1, cy}, 1);
+  grid_set<kBoard>({cx - 2, cy}, 1);
 
   spawn_food();
 }
@@ -79,25 +152,97 @@ bool SnakeEnv::is_reverse(int action) const {
   return false;
 }
 
+template <int kBoard>
 bool SnakeEnv::in_bounds(const Point& p) const {
-  return p.x >= 0 && p.y >= 0 && p.x < board_size_ && p.y < board_size_;
+  return p.x >= 0 && p.y >= 0 && p.x < board<kBoard>() && p.y < board<kBoard>();
 }
 
+template <int kBoard>
 bool SnakeEnv::grid_occupied(const Point& p) const {
-  return grid_[static_cast<std::size_t>(p.y * board_size_ + p.x)] != 0;
+  const int c = cell_index<kBoard>(p);
+  return ((occupancy_[static_cast<std::size_t>(c >> 6)] >> (c & 63)) & 1ULL) != 0;
 }
 
+template <int kBoard>
 void SnakeEnv::grid_set(const Point& p, uint8_t v) {
-  grid_[static_cast<std::size_t>(p.y * board_size_ + p.x)] = v;
+  const int c = cell_index<kBoard>(p);
+  const uint64_t bit = 1ULL << (c & 63);
+  uint64_t& word = occupancy_[static_cast<std::size_t>(c >> 6)];
+  const bool was_set = (word & bit) != 0;
+  if (v != 0 && !was_set) {
+    word |= bit;
+    free_remove(c);
+    hash_ ^= zobrist(kZobristBody, c);
+  } else if (v == 0 && was_set) {
+    word &= ~bit;
+    free_insert(c);
+    hash_ ^= zobrist(kZobristBody, c);
+  }
+}
+
+void SnakeEnv::free_insert(int cell) {
+  free_[static_cast<std::size_t>(free_count_)] = static_cast<uint16_t>(cell);
+  free_pos_[static_cast<std::size_t>(cell)] = static_cast<uint16_t>(free_count_);
+  ++free_count_;
+}
+
+void SnakeEnv::free_remove(int cell) {
+  // Swap-remove: mover la última celda libre al hueco.
+  const int pos = free_pos_[static_cast<std::size_t>(cell)];
+  const int last = free_[static_cast<std::size_t>(free_count_ - 1)];
+  free_[static_cast<std::size_t>(pos)] = static_cast<uint16_t>(last);
+  free_pos_[static_cast<std::size_t>(last)] = static_cast<uint16_t>(pos);
+  --free_count_;
+}
+
+template <int kBoard>
+void SnakeEnv::body_push_front(const Point& p) {
+  if (body_len_ > 0) {
+    hash_ ^= zobrist(kZobristHead, body_[static_cast<std::size_t>(body_head_)]);
+  }
+  hash_ ^= zobrist(kZobristHead, cell_index<kBoard>(p));
+  body_head_ = (body_head_ - 1) & kRingMask;
+  body_[static_cast<std::size_t>(body_head_)] = static_cast<uint16_t>(cell_index<kBoard>(p));
+  ++body_len_;
+}
+
+template <int kBoard>
+Point SnakeEnv::body_back() const {
+  return cell_point<kBoard>(
+      body_[static_cast<std::size_t>((body_head_ + body_len_ - 1) & kRingMask)]);
 }
 
+void SnakeEnv::body_pop_back() {
+  --body_len_;
+}
+
+Point SnakeEnv::body_point(int i) const {
+  return cell_point(body_[static_cast<std::size_t>((body_head_ + i) & kRingMask)]);
+}
+
+std::vector<Point> SnakeEnv::snake() const {
+  std::vector<Point> out;
+  out.reserve(static_cast<std::size_t>(body_len_));
+  for (int i = 0; i < body_len_; ++i) {
+    out.push_back(body_point(i));
+  }
+  return out;
+}
+
+template <int kBoard>
 Point SnakeEnv::next_head(int action) const {
   Point d = delta_for_action(action);
-  Point h = snake_.front();
+  Point h = cell_point<kBoard>(body_[static_cast<std::size_t>(body_head_)]);
   return {h.x + d.x, h.y + d.y};
 }
 
 StepResult SnakeEnv::step(int action) {
+  return dispatch_board_size(board_size_,
+                             [&](auto b) { return step_fixed<decltype(b)::value>(action); });
+}
+
+template <int kBoard>
+StepResult SnakeEnv::step_fixed(int action) {
   StepResult out{};
   if (done_) {
     out.done = true;
@@ -108,12 +253,12 @@ StepResult SnakeEnv::step(int action) {
   if (action < 0 || action > 3 || is_reverse(action)) {
     action = direction_;
   }
-  direction_ = action;
+  set_direction(action);
 
-  Point h2 = next_head(action);
+  Point h2 = next_head<kBoard>(action);
   bool grow = (h2.x == food_.x && h2.y == food_.y);
 
-  if (!in_bounds(h2)) {
+  if (!in_bounds<kBoard>(h2)) {
     done_ = true;
     won_ = false;
     out.reward = -1.0f;
@@ -123,18 +268,10 @@ StepResult SnakeEnv::step(int action) {
   }
 
   // Si no crece, la cola se va a mover, así que la celda de la cola
-  // no cuenta como colisión. Limpiamos temporalmente para el check.
-  Point tail = snake_.back();
-  if (!grow) {
-    grid_set(tail, 0);
-  }
-
-  bool body_hit = grid_occupied(h2);
-
-  if (!grow) {
-    // Restaurar grid de cola (se quitará definitivamente abajo si no hay hit).
-    grid_set(tail, 1);
-  }
+  // no cuenta como colisión.
+  Point tail = body_back<kBoard>();
+  const bool into_tail = !grow && h2.x == tail.x && h2.y == tail.y;
+  bool body_hit = grid_occupied<kBoard>(h2) && !into_tail;
 
   if (body_hit) {
     done_ = true;
@@ -145,15 +282,19 @@ StepResult SnakeEnv::step(int action) {
     return out;
   }
 
-  // Mover serpiente: agregar cabeza al grid.
-  grid_set(h2, 1);
-  snake_.push_front(h2);
+  // Mover serpiente: agregar cabeza al grid. Si entra a la celda que
+  // deja la cola, primero se libera la cola para mantener el índice libre.
+  if (into_tail) {
+    grid_set<kBoard>(tail, 0);
+  }
+  grid_set<kBoard>(h2, 1);
+  body_push_front<kBoard>(h2);
 
   if (grow) {
     out.reward = 1.0f;
     out.food_eaten = true;
     steps_since_food_ = 0;
-    if (snake_.size() >= static_cast<std::size_t>(board_size_ * board_size_)) {
+    if (body_len_ >= board<kBoard>() * board<kBoard>()) {
       done_ = true;
       won_ = true;
       out.done = true;
@@ -162,9 +303,11 @@ StepResult SnakeEnv::step(int action) {
     }
     spawn_food();
   } else {
-    // Quitar cola del grid.
-    grid_set(tail, 0);
-    snake_.pop_back();
+    // Quitar cola del grid (ya liberada si la cabeza ocupó su celda).
+    if (!into_tail) {
+      grid_set<kBoard>(tail, 0);
+    }
+    body_pop_back();
     out.reward = 0.0f;
     ++steps_since_food_;
   }
@@ -175,7 +318,7 @@ StepResult SnakeEnv::step(int action) {
   // En 20x20 = 400 pasos hay tiempo de sobra para alcanzar cualquier
   // celda. Esto mata juegos donde la serpiente da vueltas en círculos
   // y desperdicia compute (~1000 movimientos MCTS inútiles).
-  const int starvation_limit = board_size_ * board_size_;
+  const int starvation_limit = board<kBoard>() * board<kBoard>();
   if (steps_since_food_ >= starvation_limit) {
     done_ = true;
     won_ = false;
@@ -199,30 +342,41 @@ StepResult SnakeEnv::step(int action) {
 }
 
 std::vector<float> SnakeEnv::get_state() const {
-  const int size = board_size_ * board_size_;
-  std::vector<float> st(static_cast<std::size_t>(4 * size), 0.0f);
-
-  // Canal 0: cuerpo de la serpiente (usar grid directamente).
-  for (int i = 0; i < size; ++i) {
-    st[static_cast<std::size_t>(i)] = static_cast<float>(grid_[static_cast<std::size_t>(i)]);
-  }
+  std::vector<float> st(static_cast<std::size_t>(state_size()), 0.0f);
+  encode_state(st.data());
+  return st;
+}
 
-  // Canal 1: cabeza.
-  if (!snake_.empty()) {
-    const auto& h = snake_.front();
-    st[static_cast<std::size_t>(size + h.y * board_size_ + h.x)] = 1.0f;
-  }
+void SnakeEnv::encode_state(float* st) const {
+  dispatch_board_size(board_size_, [&](auto b) { encode_state_fixed<decltype(b)::value>(st); });
+}
 
-  // Canal 2: comida.
-  st[static_cast<std::size_t>(2 * size + food_.y * board_size_ + food_.x)] = 1.0f;
+template <int kBoard>
+void SnakeEnv::encode_state_fixed(float* st) const {
+  const int head = body_len_ > 0 ? body_[static_cast<std::size_t>(body_head_)] : -1;
+  write_planes<kBoard>(board_size_, occupancy_.data(), head, cell_index<kBoard>(food_), direction_, st);
+}
 
-  // Canal 3: dirección (constante en todo el tablero).
-  const float dir_val = direction_value(direction_);
-  for (int i = 0; i < size; ++i) {
-    st[static_cast<std::size_t>(3 * size + i)] = dir_val;
+PackedState SnakeEnv::pack_state() const {
+  PackedState p;
+  p.occupancy = occupancy_;
+  if (body_len_ > 0) {
+    p.head = body_[static_cast<std::size_t>(body_head_)];
   }
+  p.food = static_cast<uint16_t>(cell_index(food_));
+  p.direction = static_cast<uint8_t>(direction_);
+  return p;
+}
 
-  return st;
+void SnakeEnv::decode_state(int board_size,
+                            const uint64_t* occupancy,
+                            int head,
+                            int food,
+                            int direction,
+                            float* out) {
+  dispatch_board_size(board_size, [&](auto b) {
+    write_planes<decltype(b)::value>(board_size, occupancy, head, food, direction, out);
+  });
 }
 
 std::array<uint8_t, 4> SnakeEnv::valid_action_mask() const {
@@ -234,34 +388,79 @@ std::array<uint8_t, 4> SnakeEnv::valid_action_mask() const {
   return mask;
 }
 
+std::array<uint8_t, 4> SnakeEnv::safe_action_mask() const {
+  std::array<uint8_t, 4> mask = valid_action_mask();
+  const Point tail = body_back();
+  for (int a = 0; a < 4; ++a) {
+    if (mask[static_cast<std::size_t>(a)] == 0) {
+      continue;
+    }
+    // Mismas reglas de colisión que step_fixed.
+    const Point h2 = next_head(a);
+    const bool grow = h2.x == food_.x && h2.y == food_.y;
+    const bool into_tail = !grow && h2.x == tail.x && h2.y == tail.y;
+    if (!in_bounds(h2) || (grid_occupied(h2) && !into_tail)) {
+      mask[static_cast<std::size_t>(a)] = 0;
+    }
+  }
+  return mask;
+}
+
 std::vector<Point> SnakeEnv::free_cells() const {
   std::vector<Point> out;
-  out.reserve(static_cast<std::size_t>(board_size_ * board_size_));
-  for (int y = 0; y < board_size_; ++y) {
-    for (int x = 0; x < board_size_; ++x) {
-      if (grid_[static_cast<std::size_t>(y * board_size_ + x)] == 0) {
-        out.push_back({x, y});
-      }
-    }
+  out.reserve(static_cast<std::size_t>(free_count_));
+  for (int i = 0; i < free_count_; ++i) {
+    out.push_back(free_cell(i));
   }
   return out;
 }
 
 void SnakeEnv::set_food(const Point& p) {
   if (in_bounds(p) && !grid_occupied(p)) {
-    food_ = p;
+    place_food(p);
   }
 }
 
+void SnakeEnv::place_food(const Point& p) {
+  hash_ ^= zobrist(kZobristFood, cell_index(food_)) ^ zobrist(kZobristFood, cell_index(p));
+  food_ = p;
+}
+
+void SnakeEnv::set_direction(int action) {
+  hash_ ^= zobrist(kZobristDir, direction_) ^ zobrist(kZobristDir, action);
+  direction_ = action;
+}
+
+uint64_t SnakeEnv::full_hash() const {
+  uint64_t h = zobrist(kZobristDir, direction_) ^ zobrist(kZobristFood, cell_index(food_));
+  const int size = board_size_ * board_size_;
+  for (int c = 0; c < size; ++c) {
+    if ((occupancy_[static_cast<std::size_t>(c >> 6)] >> (c & 63)) & 1ULL) {
+      h ^= zobrist(kZobristBody, c);
+    }
+  }
+  if (body_len_ > 0) {
+    h ^= zobrist(kZobristHead, body_[static_cast<std::size_t>(body_head_)]);
+  }
+  return h;
+}
+
 void SnakeEnv::spawn_food() {
-  std::vector<Point> free = free_cells();
-  if (free.empty()) {
+  if (free_count_ == 0) {
     done_ = true;
     won_ = true;
     return;
   }
-  std::uniform_int_distribution<int> dist(0, static_cast<int>(free.size() - 1));
-  food_ = free[static_cast<std::size_t>(dist(rng_))];
+  std::uniform_int_distribution<int> dist(0, free_count_ - 1);
+  place_food(free_cell(dist(rng_)));
 }
 
+// Instancias especializadas (ver dispatch_board_size).
+template StepResult SnakeEnv::step_fixed<0>(int);
+template StepResult SnakeEnv::step_fixed<10>(int);
+template StepResult SnakeEnv::step_fixed<20>(int);
+template void SnakeEnv::encode_state_fixed<0>(float*) const;
+template void SnakeEnv::encode_state_fixed<10>(float*) const;
+template void SnakeEnv::encode_state_fixed<20>(float*) const;
+
 }  // namespace alphasnake
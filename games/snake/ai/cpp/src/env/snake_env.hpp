@@ -2,17 +2,51 @@
 
 #include <array>
 #include <cstdint>
-#include <deque>
 #include <random>
+#include <type_traits>
 #include <vector>
 
 namespace alphasnake {
 
+// Tamaño máximo de tablero soportado por el almacenamiento fijo del entorno.
+// Todo el estado vive inline (sin heap), así que copiar un SnakeEnv es un memcpy.
+inline constexpr int kMaxBoardSize = 32;
+inline constexpr int kMaxCells = kMaxBoardSize * kMaxBoardSize;
+inline constexpr int kOccupancyWords = kMaxCells / 64;
+
+// Tamaños con especialización en compilación (config_paper_10x10 / 20x20):
+// la aritmética de índices se pliega a constantes y los bucles por celda
+// tienen trip count fijo. Cualquier otro tamaño usa el camino genérico (0).
+template <typename F>
+decltype(auto) dispatch_board_size(int board_size, F&& f) {
+  switch (board_size) {
+    case 10:
+      return f(std::integral_constant<int, 10>{});
+    case 20:
+      return f(std::integral_constant<int, 20>{});
+    default:
+      return f(std::integral_constant<int, 0>{});
+  }
+}
+
 struct Point {
   int x = 0;
   int y = 0;
 };
 
+// Lo que ve la red de un entorno en forma compacta (los canales 0-2 son
+// binarios y el canal 3 es una de cuatro constantes): bitboard del cuerpo,
+// celda de la cabeza, celda de la comida y dirección. Así se guardan los
+// ejemplos de entrenamiento; se decodifica a floats solo al armar el batch.
+struct PackedState {
+  static constexpr uint16_t kNoCell = 0xFFFF;
+
+  std::array<uint64_t, kOccupancyWords> occupancy{};
+  uint16_t head = kNoCell;
+  uint16_t food = 0;
+  uint8_t direction = 3;
+};
+
 struct StepResult {
   float reward = 0.0f;
   bool done = false;
@@ -30,22 +64,72 @@ class SnakeEnv {
   StepResult step(int action);
 
   [[nodiscard]] std::vector<float> get_state() const;
+  // Codifica el estado 4xNxN directamente en un buffer del llamador
+  // (p. ej. un slot del tensor de batch). out debe tener state_size() floats.
+  void encode_state(float* out) const;
+
+  // Variantes especializadas: kBoard es 0 (genérico) o el valor que entrega
+  // dispatch_board_size(board_size()). step/encode_state despachan solas;
+  // llamarlas directo evita el switch en bucles calientes (MCTS, batcher).
+  template <int kBoard>
+  StepResult step_fixed(int action);
+  template <int kBoard>
+  void encode_state_fixed(float* out) const;
+  [[nodiscard]] int state_size() const { return 4 * board_size_ * board_size_; }
+
+  [[nodiscard]] PackedState pack_state() const;
+  // Escribe en out (4 * board_size² floats) lo mismo que encode_state habría
+  // escrito para el entorno empaquetado. occupancy usa el layout del
+  // bitboard (bit c = celda y * board_size + x), así que basta con las
+  // primeras ceil(board_size² / 64) palabras.
+  static void decode_state(int board_size,
+                           const uint64_t* occupancy,
+                           int head,
+                           int food,
+                           int direction,
+                           float* out);
+  static void decode_state(int board_size, const PackedState& packed, float* out) {
+    decode_state(board_size, packed.occupancy.data(), packed.head, packed.food, packed.direction, out);
+  }
   [[nodiscard]] std::array<uint8_t, 4> valid_action_mask() const;
+  // valid_action_mask sin las jugadas que mueren en el próximo paso (pared o
+  // cuerpo; la celda de la cola cuenta libre salvo que la jugada coma).
+  // Todo en cero = no hay jugada que sobreviva.
+  [[nodiscard]] std::array<uint8_t, 4> safe_action_mask() const;
   [[nodiscard]] std::vector<Point> free_cells() const;
+  // Acceso O(1) sin asignaciones al índice de celdas libres (orden arbitrario).
+  [[nodiscard]] int free_cell_count() const { return free_count_; }
+  [[nodiscard]] Point free_cell(int i) const { return cell_point(free_[static_cast<std::size_t>(i)]); }
 
   void set_food(const Point& p);
 
   [[nodiscard]] int board_size() const { return board_size_; }
   [[nodiscard]] int max_steps() const { return max_steps_; }
   [[nodiscard]] int steps() const { return steps_; }
+  [[nodiscard]] int steps_since_food() const { return steps_since_food_; }
   [[nodiscard]] int direction() const { return direction_; }
-  [[nodiscard]] std::size_t snake_length() const { return snake_.size(); }
+  [[nodiscard]] std::size_t snake_length() const { return static_cast<std::size_t>(body_len_); }
   [[nodiscard]] bool is_done() const { return done_; }
   [[nodiscard]] bool is_win() const { return won_; }
-  [[nodiscard]] const std::deque<Point>& snake() const { return snake_; }
+  [[nodiscard]] Point head() const { return body_point(0); }
+  // Segmento i del cuerpo contando desde la cabeza (0 = cabeza).
+  [[nodiscard]] Point body_point(int i) const;
+  // Copia del cuerpo cabeza→cola. Reserva memoria: solo para tests/debug.
+  [[nodiscard]] std::vector<Point> snake() const;
   [[nodiscard]] Point food() const { return food_; }
+  [[nodiscard]] const std::array<uint64_t, kOccupancyWords>& occupancy() const { return occupancy_; }
+
+  // Hash Zobrist de lo que ve la red (celdas del cuerpo, cabeza, comida y
+  // dirección), mantenido incrementalmente en step/set_food. Dos entornos con
+  // el mismo hash codifican el mismo estado: clave del cache de predicciones.
+  [[nodiscard]] uint64_t hash() const { return hash_; }
+  // Recalcula el hash desde cero. Solo para tests/debug.
+  [[nodiscard]] uint64_t full_hash() const;
 
  private:
+  static constexpr int kRingMask = kMaxCells - 1;
+  static_assert((kMaxCells & kRingMask) == 0, "el ring buffer requiere capacidad potencia de 2");
+
   int board_size_ = 20;
   int max_steps_ = 2000;
   int steps_ = 0;
@@ -55,17 +139,54 @@ class SnakeEnv {
   bool done_ = false;
   bool won_ = false;
 
-  std::deque<Point> snake_;
+  // Cuerpo como ring buffer de índices de celda (y * board_size + x).
+  // body_[body_head_] es la cabeza; la cola está body_len_ - 1 posiciones después.
+  std::array<uint16_t, kMaxCells> body_{};
+  int body_head_ = 0;
+  int body_len_ = 0;
+
   Point food_{};
-  std::vector<uint8_t> grid_;  // bitboard: 1 = celda ocupada por serpiente
+  std::array<uint64_t, kOccupancyWords> occupancy_{};  // bitboard: 1 = celda ocupada por serpiente
+
+  // Celdas libres como arreglo denso + posición inversa (swap-remove O(1)).
+  // free_pos_[c] solo es válido mientras la celda c está libre.
+  std::array<uint16_t, kMaxCells> free_{};
+  std::array<uint16_t, kMaxCells> free_pos_{};
+  int free_count_ = 0;
+
+  uint64_t hash_ = 0;
 
   std::mt19937 rng_;
 
+  template <int kBoard = 0>
+  [[nodiscard]] int board() const { return kBoard > 0 ? kBoard : board_size_; }
+  template <int kBoard = 0>
+  [[nodiscard]] int cell_index(const Point& p) const { return p.y * board<kBoard>() + p.x; }
+  template <int kBoard = 0>
+  [[nodiscard]] Point cell_point(int cell) const {
+    return {cell % board<kBoard>(), cell / board<kBoard>()};
+  }
+
   [[nodiscard]] bool is_reverse(int action) const;
+  template <int kBoard = 0>
   [[nodiscard]] bool in_bounds(const Point& p) const;
+  template <int kBoard = 0>
   [[nodiscard]] bool grid_occupied(const Point& p) const;
+  template <int kBoard = 0>
   [[nodiscard]] Point next_head(int action) const;
+  template <int kBoard = 0>
   void grid_set(const Point& p, uint8_t v);
+  void free_insert(int cell);
+  void free_remove(int cell);
+  template <int kBoard = 0>
+  void body_push_front(const Point& p);
+  template <int kBoard = 0>
+  [[nodiscard]] Point body_back() const;
+  void body_pop_back();
+  void place_food(const Point& p);
+  void set_direction(int action);
+  template <int kBoard = 0>
+  void reset_board();
   void spawn_food();
 };
 
@@ -0,0 +1,427 @@
+#include "env/snake_env_batch.hpp"
+
+#include <algorithm>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define ALPHASNAKE_HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#define ALPHASNAKE_AVX2 __attribute__((target("avx2")))
+#else
+#define ALPHASNAKE_HAVE_AVX2_KERNEL 0
+#endif
+
+namespace alphasnake {
+namespace {
+
+constexpr float kDirectionValue[4] = {0.25f, 0.5f, 0.75f, 1.0f};
+
+#if ALPHASNAKE_HAVE_AVX2_KERNEL
+
+// Kernel de planificación: 8 juegos por iteración. Sanea la acción (reversa o
+// fuera de rango => sigue la dirección actual), calcula la celda destino y
+// marca bordes, comida y entrada a la celda de la cola.
+ALPHASNAKE_AVX2 int plan_moves_avx2(int n,
+                                    int board_size,
+                                    const int* actions,
+                                    const int32_t* dir,
+                                    const int32_t* head_x,
+                                    const int32_t* head_y,
+                                    const int32_t* food_cell,
+                                    const int32_t* tail_cell,
+                                    int32_t* plan_dir,
+                                    int32_t* plan_cell,
+                                    int32_t* plan) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i two = _mm256_set1_epi32(2);
+  const __m256i three = _mm256_set1_epi32(3);
+  const __m256i bsize = _mm256_set1_epi32(board_size);
+  const __m256i bmax = _mm256_set1_epi32(board_size - 1);
+  const __m256i f_oob = _mm256_set1_epi32(1);
+  const __m256i f_grow = _mm256_set1_epi32(2);
+  const __m256i f_tail = _mm256_set1_epi32(4);
+
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(actions + i));
+    const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dir + i));
+
+    // Reversa directa: pares (0,1) y (2,3) => a ^ 1 == dir.
+    const __m256i invalid = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpgt_epi32(zero, a), _mm256_cmpgt_epi32(a, three)),
+        _mm256_cmpeq_epi32(_mm256_xor_si256(a, one), d));
+    a = _mm256_blendv_epi8(a, d, invalid);
+
+    // Las comparaciones valen -1 si son ciertas: dx = [a==2] - [a==3] en máscaras.
+    const __m256i dx = _mm256_sub_epi32(_mm256_cmpeq_epi32(a, two), _mm256_cmpeq_epi32(a, three));
+    const __m256i dy = _mm256_sub_epi32(_mm256_cmpeq_epi32(a, zero), _mm256_cmpeq_epi32(a, one));
+    const __m256i nx = _mm256_add_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(head_x + i)), dx);
+    const __m256i ny = _mm256_add_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(head_y + i)), dy);
+
+    const __m256i oob = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpgt_epi32(zero, nx), _mm256_cmpgt_epi32(zero, ny)),
+        _mm256_or_si256(_mm256_cmpgt_epi32(nx, bmax), _mm256_cmpgt_epi32(ny, bmax)));
+    const __m256i cell =
+        _mm256_andnot_si256(oob, _mm256_add_epi32(_mm256_mullo_epi32(ny, bsize), nx));
+
+    const __m256i food = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(food_cell + i));
+    const __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail_cell + i));
+    const __m256i grow = _mm256_andnot_si256(oob, _mm256_cmpeq_epi32(cell, food));
+    const __m256i into_tail =
+        _mm256_andnot_si256(_mm256_or_si256(oob, grow), _mm256_cmpeq_epi32(cell, tail));
+
+    const __m256i flags = _mm256_or_si256(
+        _mm256_and_si256(oob, f_oob),
+        _mm256_or_si256(_mm256_and_si256(grow, f_grow), _mm256_and_si256(into_tail, f_tail)));
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(plan_dir + i), a);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(plan_cell + i), cell);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(plan + i), flags);
+  }
+  return i;
+}
+
+// Kernel de colisión con el cuerpo: 4 juegos por iteración con gather de la
+// palabra de 64 bits del bitboard que contiene la celda destino.
+ALPHASNAKE_AVX2 int collide_body_avx2(int n,
+                                      const uint64_t* occupancy,
+                                      const int32_t* plan_cell,
+                                      int32_t* plan) {
+  const __m128i words_per_env = _mm_set1_epi32(kOccupancyWords);
+  const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+  const __m128i skip = _mm_set1_epi32(1 | 4);  // fuera de borde o entra a la cola
+  const __m256i low_dwords = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  const __m256i one64 = _mm256_set1_epi64x(1);
+
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128i cell = _mm_loadu_si128(reinterpret_cast<const __m128i*>(plan_cell + i));
+    const __m128i env = _mm_add_epi32(_mm_set1_epi32(i), lane);
+    const __m128i word_idx =
+        _mm_add_epi32(_mm_mullo_epi32(env, words_per_env), _mm_srli_epi32(cell, 6));
+    const __m256i words = _mm256_i32gather_epi64(
+        reinterpret_cast<const long long*>(occupancy), word_idx, 8);
+    const __m256i shift = _mm256_cvtepi32_epi64(_mm_and_si128(cell, _mm_set1_epi32(63)));
+    const __m256i bit64 = _mm256_and_si256(_mm256_srlv_epi64(words, shift), one64);
+    const __m128i bit =
+        _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(bit64, low_dwords));
+
+    __m128i flags = _mm_loadu_si128(reinterpret_cast<const __m128i*>(plan + i));
+    const __m128i check = _mm_cmpeq_epi32(_mm_and_si128(flags, skip), _mm_setzero_si128());
+    const __m128i hit = _mm_and_si128(bit, check);
+    flags = _mm_or_si128(flags, _mm_slli_epi32(hit, 3));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(plan + i), flags);
+  }
+  return i;
+}
+
+// Canal 0: expande 8 bits del bitboard a 8 floats 0/1 por iteración.
+ALPHASNAKE_AVX2 int encode_occupancy_avx2(const uint64_t* words, int cells, float* dst) {
+  const __m256i bitsel = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  const __m256 ones = _mm256_set1_ps(1.0f);
+  int c = 0;
+  for (; c + 8 <= cells; c += 8) {
+    const int byte = static_cast<int>((words[c >> 6] >> (c & 63)) & 0xFFULL);
+    const __m256i m = _mm256_and_si256(_mm256_set1_epi32(byte), bitsel);
+    const __m256i set = _mm256_cmpeq_epi32(m, bitsel);
+    _mm256_storeu_ps(dst + c, _mm256_and_ps(_mm256_castsi256_ps(set), ones));
+  }
+  return c;
+}
+
+#endif  // ALPHASNAKE_HAVE_AVX2_KERNEL
+
+}  // namespace
+
+SnakeEnvBatch::SnakeEnvBatch(int num_envs, int board_size, int max_steps, uint32_t seed)
+    : n_(std::max(1, num_envs)),
+      board_size_(std::max(3, std::min(board_size, kMaxBoardSize))),
+      cells_(board_size_ * board_size_),
+      max_steps_(max_steps),
+      use_simd_(simd_available()),
+      head_x_(idx(n_)),
+      head_y_(idx(n_)),
+      dir_(idx(n_)),
+      len_(idx(n_)),
+      food_cell_(idx(n_)),
+      tail_cell_(idx(n_)),
+      done_(idx(n_)),
+      won_(idx(n_)),
+      steps_(idx(n_)),
+      steps_since_food_(idx(n_)),
+      occupancy_(idx(n_) * kOccupancyWords),
+      body_(idx(n_) * idx(cells_)),
+      body_head_(idx(n_)),
+      free_(idx(n_) * idx(cells_)),
+      free_pos_(idx(n_) * idx(cells_)),
+      free_count_(idx(n_)),
+      rng_(idx(n_)),
+      plan_dir_(idx(n_)),
+      plan_cell_(idx(n_)),
+      plan_(idx(n_)) {
+  for (int i = 0; i < n_; ++i) {
+    reset(i, seed + static_cast<uint32_t>(i));
+  }
+}
+
+bool SnakeEnvBatch::simd_available() {
+#if ALPHASNAKE_HAVE_AVX2_KERNEL
+  static const bool ok = __builtin_cpu_supports("avx2");
+  return ok;
+#else
+  return false;
+#endif
+}
+
+void SnakeEnvBatch::reset(int i, uint32_t seed) {
+  const std::size_t e = idx(i);
+  rng_[e].seed(seed);
+  done_[e] = 0;
+  won_[e] = 0;
+  steps_[e] = 0;
+  steps_since_food_[e] = 0;
+  dir_[e] = 3;
+
+  std::fill_n(occupancy_.begin() + static_cast<std::ptrdiff_t>(e * kOccupancyWords),
+              kOccupancyWords, 0ULL);
+  uint16_t* fr = free_.data() + e * idx(cells_);
+  uint16_t* fp = free_pos_.data() + e * idx(cells_);
+  for (int c = 0; c < cells_; ++c) {
+    fr[c] = static_cast<uint16_t>(c);
+    fp[c] = static_cast<uint16_t>(c);
+  }
+  free_count_[e] = cells_;
+
+  // Mismo orden que SnakeEnv::reset para que el índice libre evolucione igual.
+  const int cx = board_size_ / 2;
+  const int cy = board_size_ / 2;
+  uint16_t* body = body_.data() + e * idx(cells_);
+  body[0] = static_cast<uint16_t>(cy * board_size_ + cx);
+  body[1] = static_cast<uint16_t>(cy * board_size_ + cx - 1);
+  body[2] = static_cast<uint16_t>(cy * board_size_ + cx - 2);
+  body_head_[e] = 0;
+  len_[e] = 3;
+  head_x_[e] = cx;
+  head_y_[e] = cy;
+  tail_cell_[e] = body[2];
+
+  occ_set(i, body[0]);
+  occ_set(i, body[1]);
+  occ_set(i, body[2]);
+
+  spawn_food(i);
+}
+
+void SnakeEnvBatch::occ_set(int i, int cell) {
+  uint64_t& word = occupancy_[idx(i) * kOccupancyWords + idx(cell >> 6)];
+  const uint64_t bit = 1ULL << (cell & 63);
+  if ((word & bit) != 0) {
+    return;
+  }
+  word |= bit;
+  // Swap-remove del índice de celdas libres.
+  uint16_t* fr = free_.data() + idx(i) * idx(cells_);
+  uint16_t* fp = free_pos_.data() + idx(i) * idx(cells_);
+  int& count = free_count_[idx(i)];
+  const int pos = fp[cell];
+  const int last = fr[count - 1];
+  fr[pos] = static_cast<uint16_t>(last);
+  fp[last] = static_cast<uint16_t>(pos);
+  --count;
+}
+
+void SnakeEnvBatch::occ_clear(int i, int cell) {
+  uint64_t& word = occupancy_[idx(i) * kOccupancyWords + idx(cell >> 6)];
+  const uint64_t bit = 1ULL << (cell & 63);
+  if ((word & bit) == 0) {
+    return;
+  }
+  word &= ~bit;
+  uint16_t* fr = free_.data() + idx(i) * idx(cells_);
+  uint16_t* fp = free_pos_.data() + idx(i) * idx(cells_);
+  int& count = free_count_[idx(i)];
+  fr[count] = static_cast<uint16_t>(cell);
+  fp[cell] = static_cast<uint16_t>(count);
+  ++count;
+}
+
+void SnakeEnvBatch::spawn_food(int i) {
+  const std::size_t e = idx(i);
+  if (free_count_[e] == 0) {
+    done_[e] = 1;
+    won_[e] = 1;
+    return;
+  }
+  std::uniform_int_distribution<int> dist(0, free_count_[e] - 1);
+  food_cell_[e] = free_[e * idx(cells_) + idx(dist(rng_[e]))];
+}
+
+void SnakeEnvBatch::plan_scalar(const int* actions, int begin) {
+  for (int i = begin; i < n_; ++i) {
+    const std::size_t e = idx(i);
+    int a = actions[i];
+    const int d = dir_[e];
+    if (a < 0 || a > 3 || (a ^ 1) == d) {
+      a = d;
+    }
+    const int dx = static_cast<int>(a == 3) - static_cast<int>(a == 2);
+    const int dy = static_cast<int>(a == 1) - static_cast<int>(a == 0);
+    const int nx = head_x_[e] + dx;
+    const int ny = head_y_[e] + dy;
+    const bool oob = nx < 0 || ny < 0 || nx >= board_size_ || ny >= board_size_;
+    const int cell = oob ? 0 : ny * board_size_ + nx;
+    const bool grow = !oob && cell == food_cell_[e];
+    const bool into_tail = !oob && !grow && cell == tail_cell_[e];
+
+    plan_dir_[e] = a;
+    plan_cell_[e] = cell;
+    plan_[e] = (oob ? kOutOfBounds : 0) | (grow ? kGrow : 0) | (into_tail ? kIntoTail : 0);
+  }
+}
+
+void SnakeEnvBatch::collide_scalar(int begin) {
+  for (int i = begin; i < n_; ++i) {
+    const std::size_t e = idx(i);
+    if ((plan_[e] & (kOutOfBounds | kIntoTail)) != 0) {
+      continue;
+    }
+    const int cell = plan_cell_[e];
+    const uint64_t word = occupancy_[e * kOccupancyWords + idx(cell >> 6)];
+    if (((word >> (cell & 63)) & 1ULL) != 0) {
+      plan_[e] |= kBodyHit;
+    }
+  }
+}
+
+void SnakeEnvBatch::plan_simd(const int* actions) {
+#if ALPHASNAKE_HAVE_AVX2_KERNEL
+  const int done = plan_moves_avx2(n_, board_size_, actions, dir_.data(), head_x_.data(),
+                                   head_y_.data(), food_cell_.data(), tail_cell_.data(),
+                                   plan_dir_.data(), plan_cell_.data(), plan_.data());
+  plan_scalar(actions, done);
+#else
+  plan_scalar(actions, 0);
+#endif
+}
+
+void SnakeEnvBatch::collide_simd() {
+#if ALPHASNAKE_HAVE_AVX2_KERNEL
+  const int done = collide_body_avx2(n_, occupancy_.data(), plan_cell_.data(), plan_.data());
+  collide_scalar(done);
+#else
+  collide_scalar(0);
+#endif
+}
+
+void SnakeEnvBatch::step(const int* actions, StepResult* out) {
+  if (use_simd_) {
+    plan_simd(actions);
+    collide_simd();
+  } else {
+    plan_scalar(actions, 0);
+    collide_scalar(0);
+  }
+  for (int i = 0; i < n_; ++i) {
+    apply(i, out[i]);
+  }
+}
+
+// Aplica el paso planificado replicando SnakeEnv::step rama por rama.
+void SnakeEnvBatch::apply(int i, StepResult& out) {
+  const std::size_t e = idx(i);
+  out = StepResult{};
+  if (done_[e] != 0) {
+    out.done = true;
+    out.won = won_[e] != 0;
+    return;
+  }
+
+  dir_[e] = plan_dir_[e];
+  const int32_t flags = plan_[e];
+  if ((flags & (kOutOfBounds | kBodyHit)) != 0) {
+    done_[e] = 1;
+    won_[e] = 0;
+    out.reward = -1.0f;
+    out.done = true;
+    return;
+  }
+
+  const int cell = plan_cell_[e];
+  const bool grow = (flags & kGrow) != 0;
+  const bool into_tail = (flags & kIntoTail) != 0;
+  uint16_t* body = body_.data() + e * idx(cells_);
+
+  if (into_tail) {
+    occ_clear(i, tail_cell_[e]);
+  }
+  occ_set(i, cell);
+  body_head_[e] = body_head_[e] == 0 ? cells_ - 1 : body_head_[e] - 1;
+  body[body_head_[e]] = static_cast<uint16_t>(cell);
+  ++len_[e];
+  head_x_[e] = cell % board_size_;
+  head_y_[e] = cell / board_size_;
+
+  if (grow) {
+    out.reward = 1.0f;
+    out.food_eaten = true;
+    steps_since_food_[e] = 0;
+    if (len_[e] >= cells_) {
+      done_[e] = 1;
+      won_[e] = 1;
+      out.done = true;
+      out.won = true;
+      return;
+    }
+    spawn_food(i);
+  } else {
+    if (!into_tail) {
+      occ_clear(i, tail_cell_[e]);
+    }
+    --len_[e];
+    tail_cell_[e] = body[(body_head_[e] + len_[e] - 1) % cells_];
+    ++steps_since_food_[e];
+  }
+
+  ++steps_[e];
+
+  if (steps_since_food_[e] >= cells_) {
+    done_[e] = 1;
+    won_[e] = 0;
+    out.reward = -1.0f;
+    out.done = true;
+    return;
+  }
+
+  if (steps_[e] >= max_steps_) {
+    done_[e] = 1;
+    won_[e] = 0;
+    out.done = true;
+  }
+}
+
+void SnakeEnvBatch::get_state(float* out) const {
+  for (int i = 0; i < n_; ++i) {
+    const std::size_t e = idx(i);
+    float* st = out + e * idx(state_size());
+    const uint64_t* words = occupancy_.data() + e * kOccupancyWords;
+
+    int c = 0;
+#if ALPHASNAKE_HAVE_AVX2_KERNEL
+    if (use_simd_) {
+      c = encode_occupancy_avx2(words, cells_, st);
+    }
+#endif
+    for (; c < cells_; ++c) {
+      st[c] = static_cast<float>((words[c >> 6] >> (c & 63)) & 1ULL);
+    }
+
+    std::fill(st + cells_, st + 3 * cells_, 0.0f);
+    st[cells_ + head_y_[e] * board_size_ + head_x_[e]] = 1.0f;
+    st[2 * cells_ + food_cell_[e]] = 1.0f;
+    std::fill(st + 3 * cells_, st + 4 * cells_, kDirectionValue[dir_[e] & 3]);
+  }
+}
+
+}  // namespace alphasnake
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "env/snake_env.hpp"
+
+namespace alphasnake {
+
+// N juegos independientes avanzando en lockstep con layout SoA (structure of
+// arrays). Pensado para rollouts solo-política, evaluación y generación de
+// datos: chequeos de bordes, comida y colisión corren como kernels SIMD
+// (AVX2 si la CPU lo soporta, escalar si no) sobre todos los juegos a la vez.
+//
+// Semántica idéntica a SnakeEnv: con las mismas seeds produce exactamente la
+// misma secuencia de estados, recompensas y comida.
+class SnakeEnvBatch {
+ public:
+  // El juego i arranca con seed + i.
+  SnakeEnvBatch(int num_envs, int board_size = 20, int max_steps = 2000, uint32_t seed = 42);
+
+  void reset(int i, uint32_t seed);
+
+  // Avanza todos los juegos; actions y out tienen size() elementos.
+  // Los juegos terminados no cambian y reportan done=true.
+  void step(const int* actions, StepResult* out);
+
+  // Escribe size() estados contiguos [N, 4, B, B] (mismo formato que SnakeEnv).
+  void get_state(float* out) const;
+
+  [[nodiscard]] int size() const { return n_; }
+  [[nodiscard]] int board_size() const { return board_size_; }
+  [[nodiscard]] int state_size() const { return 4 * cells_; }
+  [[nodiscard]] bool is_done(int i) const { return done_[idx(i)] != 0; }
+  [[nodiscard]] bool is_win(int i) const { return won_[idx(i)] != 0; }
+  [[nodiscard]] int steps(int i) const { return steps_[idx(i)]; }
+  [[nodiscard]] int direction(int i) const { return dir_[idx(i)]; }
+  [[nodiscard]] std::size_t snake_length(int i) const { return static_cast<std::size_t>(len_[idx(i)]); }
+  [[nodiscard]] Point head(int i) const { return {head_x_[idx(i)], head_y_[idx(i)]}; }
+  [[nodiscard]] Point food(int i) const { return cell_point(food_cell_[idx(i)]); }
+
+  [[nodiscard]] static bool simd_available();
+  // Fuerza el camino escalar (tests y benchmarks comparan ambos).
+  void set_use_simd(bool on) { use_simd_ = on && simd_available(); }
+  [[nodiscard]] bool use_simd() const { return use_simd_; }
+
+ private:
+  // Bits de plan_ producidos por los kernels antes de aplicar el paso.
+  static constexpr int32_t kOutOfBounds = 1;
+  static constexpr int32_t kGrow = 2;
+  static constexpr int32_t kIntoTail = 4;
+  static constexpr int32_t kBodyHit = 8;
+
+  int n_ = 0;
+  int board_size_ = 20;
+  int cells_ = 400;
+  int max_steps_ = 2000;
+  bool use_simd_ = false;
+
+  // Estado por juego, un arreglo contiguo por campo (int32 para cargas SIMD).
+  std::vector<int32_t> head_x_;
+  std::vector<int32_t> head_y_;
+  std::vector<int32_t> dir_;
+  std::vector<int32_t> len_;
+  std::vector<int32_t> food_cell_;
+  std::vector<int32_t> tail_cell_;
+  std::vector<int32_t> done_;
+  std::vector<int32_t> won_;
+  std::vector<int32_t> steps_;
+  std::vector<int32_t> steps_since_food_;
+
+  std::vector<uint64_t> occupancy_;  // n_ * kOccupancyWords
+  std::vector<uint16_t> body_;       // n_ * cells_, ring buffer por juego
+  std::vector<int32_t> body_head_;
+  std::vector<uint16_t> free_;       // n_ * cells_, celdas libres densas
+  std::vector<uint16_t> free_pos_;   // n_ * cells_, posición inversa
+  std::vector<int32_t> free_count_;
+  std::vector<std::mt19937> rng_;
+
+  // Scratch de los kernels: acción saneada, celda destino y flags.
+  std::vector<int32_t> plan_dir_;
+  std::vector<int32_t> plan_cell_;
+  std::vector<int32_t> plan_;
+
+  [[nodiscard]] static std::size_t idx(int i) { return static_cast<std::size_t>(i); }
+  [[nodiscard]] Point cell_point(int cell) const { return {cell % board_size_, cell / board_size_}; }
+
+  void plan_scalar(const int* actions, int begin);
+  void collide_scalar(int begin);
+  void plan_simd(const int* actions);
+  void collide_simd();
+  void apply(int i, StepResult& out);
+
+  void occ_set(int i, int cell);
+  void occ_clear(int i, int cell);
+  void spawn_food(int i);
+};
+
+}  // namespace alphasnake
@@ -0,0 +1,796 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "common/cli.hpp"
+#include "common/config.hpp"
+#include "env/snake_env.hpp"
+#include "env/snake_env_batch.hpp"
+#include "mcts/mcts.hpp"
+#include "model/policy_value_model.hpp"
+#include "model/prediction_cache.hpp"
+#include "train/batch_prefetcher.hpp"
+#include "train/inference_batcher.hpp"
+#include "train/replay_buffer.hpp"
+
+using namespace alphasnake;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Evita que el compilador elimine el trabajo medido.
+template <typename T>
+void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const void* sink;
+  sink = &value;
+#endif
+}
+
+struct BenchResult {
+  std::string name;
+  std::string unit = "ops";
+  long long iterations = 0;
+  double seconds = 0.0;
+  // Parámetros del caso y métricas extra (latencias, batch promedio...).
+  std::vector<std::pair<std::string, double>> params;
+  std::vector<std::pair<std::string, double>> metrics;
+
+  [[nodiscard]] double rate() const { return seconds > 0.0 ? iterations / seconds : 0.0; }
+};
+
+double seconds_since(Clock::time_point t0) {
+  return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+// Repite fn(n) duplicando n hasta acumular min_time segundos; fn devuelve
+// cuántas unidades (pasos, sims, estados...) procesó.
+template <typename F>
+BenchResult run_timed(const std::string& name, const std::string& unit, double min_time, F&& fn) {
+  BenchResult r;
+  r.name = name;
+  r.unit = unit;
+  long long n = 1;
+  while (r.seconds < min_time) {
+    const auto t0 = Clock::now();
+    r.iterations += fn(n);
+    r.seconds += seconds_since(t0);
+    n = std::min<long long>(n * 2, 1LL << 20);
+  }
+  return r;
+}
+
+std::string json_escape(const std::string& s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+    }
+    out.push_back(c);
+  }
+  return out;
+}
+
+void write_pairs(std::ostream& os, const std::vector<std::pair<std::string, double>>& kv) {
+  os << "{";
+  for (std::size_t i = 0; i < kv.size(); ++i) {
+    os << (i ? ", " : "") << "\"" << json_escape(kv[i].first) << "\": " << kv[i].second;
+  }
+  os << "}";
+}
+
+void write_json(std::ostream& os,
+                const std::vector<std::pair<std::string, std::string>>& meta,
+                const std::vector<BenchResult>& results) {
+  os << std::setprecision(10);
+  os << "{\n  \"meta\": {";
+  for (std::size_t i = 0; i < meta.size(); ++i) {
+    os << (i ? ", " : "") << "\"" << json_escape(meta[i].first) << "\": \""
+       << json_escape(meta[i].second) << "\"";
+  }
+  os << "},\n  \"benchmarks\": [\n";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    os << "    {\"name\": \"" << json_escape(r.name) << "\", \"unit\": \"" << r.unit
+       << "\", \"iterations\": " << r.iterations << ", \"seconds\": " << r.seconds
+       << ", \"per_second\": " << r.rate()
+       << ", \"ns_per_unit\": " << (r.iterations > 0 ? r.seconds * 1e9 / r.iterations : 0.0)
+       << ", \"params\": ";
+    write_pairs(os, r.params);
+    os << ", \"metrics\": ";
+    write_pairs(os, r.metrics);
+    os << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  os << "  ]\n}\n";
+}
+
+double percentile(std::vector<double>& v, double q) {
+  if (v.empty()) {
+    return 0.0;
+  }
+  const std::size_t k = std::min(v.size() - 1, static_cast<std::size_t>(q * (v.size() - 1)));
+  std::nth_element(v.begin(), v.begin() + static_cast<std::ptrdiff_t>(k), v.end());
+  return v[k];
+}
+
+// Posición de mitad de juego para que los benchmarks no midan solo el inicio.
+SnakeEnv midgame_env(int board, uint32_t seed) {
+  SnakeEnv env(board, 100000, seed);
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> act(0, 3);
+  for (int t = 0; t < board * 2; ++t) {
+    SnakeEnv next = env;
+    next.step(act(rng));
+    if (!next.is_done()) {
+      env = next;
+    }
+  }
+  return env;
+}
+
+void bench_env(int board, double min_time, std::vector<BenchResult>& out) {
+  const std::string tag = "[" + std::to_string(board) + "]";
+  std::vector<int> actions(4096);
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> act(0, 3);
+  for (auto& a : actions) a = act(rng);
+
+  {
+    SnakeEnv env(board, 2000, 1);
+    std::size_t k = 0;
+    auto r = run_timed("env.step" + tag, "steps", min_time, [&](long long n) {
+      for (long long i = 0; i < n; ++i) {
+        env.step(actions[k++ & 4095]);
+        if (env.is_done()) {
+          env.reset(static_cast<uint32_t>(k));
+        }
+      }
+      return n;
+    });
+    r.params = {{"board", board}};
+    out.push_back(r);
+  }
+
+  const SnakeEnv mid = midgame_env(board, 3);
+  {
+    auto r = run_timed("env.get_state" + tag, "states", min_time, [&](long long n) {
+      for (long long i = 0; i < n; ++i) {
+        auto st = mid.get_state();
+        do_not_optimize(st.data());
+      }
+      return n;
+    });
+    r.params = {{"board", board}};
+    out.push_back(r);
+  }
+  {
+    std::vector<float> buf(static_cast<std::size_t>(mid.state_size()));
+    auto r = run_timed("env.encode_state" + tag, "states", min_time, [&](long long n) {
+      for (long long i = 0; i < n; ++i) {
+        mid.encode_state(buf.data());
+        do_not_optimize(buf.data());
+      }
+      return n;
+    });
+    r.params = {{"board", board}};
+    out.push_back(r);
+  }
+  {
+    auto r = run_timed("env.free_cells" + tag, "calls", min_time, [&](long long n) {
+      for (long long i = 0; i < n; ++i) {
+        auto free = mid.free_cells();
+        do_not_optimize(free.data());
+      }
+      return n;
+    });
+    r.params = {{"board", board}, {"free_cells", mid.free_cell_count()}};
+    out.push_back(r);
+  }
+  {
+    auto r = run_timed("env.copy" + tag, "copies", min_time, [&](long long n) {
+      for (long long i = 0; i < n; ++i) {
+        SnakeEnv c = mid;
+        do_not_optimize(c);
+      }
+      return n;
+    });
+    r.params = {{"board", board}, {"bytes", static_cast<double>(sizeof(SnakeEnv))}};
+    out.push_back(r);
+  }
+  {
+    const int envs = 256;
+    SnakeEnvBatch batch(envs, board, 2000, 1);
+    std::vector<int> acts(static_cast<std::size_t>(envs));
+    std::vector<StepResult> res(static_cast<std::size_t>(envs));
+    uint32_t next_seed = 1000;
+    std::size_t k = 0;
+    auto r = run_timed("env_batch.step" + tag, "steps", min_time, [&](long long n) {
+      for (long long i = 0; i < n; ++i) {
+        for (auto& a : acts) a = actions[k++ & 4095];
+        batch.step(acts.data(), res.data());
+        for (int e = 0; e < envs; ++e) {
+          if (batch.is_done(e)) {
+            batch.reset(e, next_seed++);
+          }
+        }
+      }
+      return n * envs;
+    });
+    r.params = {{"board", board}, {"envs", envs}, {"simd", batch.use_simd() ? 1.0 : 0.0}};
+    out.push_back(r);
+  }
+}
+
+void bench_mcts(const TrainConfig& base, double min_time, std::vector<BenchResult>& out) {
+  TrainConfig cfg = base;
+  // Evaluador constante: mide solo el costo del árbol y del entorno.
+  MCTS::PredictFn predict = [](const SnakeEnv&) { return Prediction{}; };
+  MCTS::BatchPredictFn batch_predict = [](const std::vector<const SnakeEnv*>& envs) {
+    return std::vector<Prediction>(envs.size());
+  };
+  const SnakeEnv mid = midgame_env(cfg.board_size, 5);
+  uint32_t seed = 1;
+  MCTS mcts(cfg, predict, batch_predict, seed);
+  auto r = run_timed("mcts.search[" + std::to_string(cfg.board_size) + "]", "sims", min_time,
+                     [&](long long n) {
+                       for (long long i = 0; i < n; ++i) {
+                         mcts.reseed(seed++);
+                         auto pi = mcts.search(mid, true, 1.0f);
+                         do_not_optimize(pi);
+                       }
+                       return n * cfg.num_simulations;
+                     });
+  r.params = {{"board", cfg.board_size},
+              {"simulations", cfg.num_simulations},
+              {"food_samples", cfg.food_samples}};
+  out.push_back(r);
+
+  // Paralelismo de hojas: estados por llamada batch con virtual loss.
+  for (const int leaf_batch : {8, 32}) {
+    TrainConfig lcfg = cfg;
+    lcfg.leaf_batch_size = leaf_batch;
+    long long calls = 0;
+    long long states = 0;
+    MCTS::BatchPredictFn counting_batch = [&](const std::vector<const SnakeEnv*>& envs) {
+      ++calls;
+      states += static_cast<long long>(envs.size());
+      return std::vector<Prediction>(envs.size());
+    };
+    MCTS leaf_mcts(lcfg, predict, counting_batch, seed);
+    auto l = run_timed("mcts.search_leaf" + std::to_string(leaf_batch) + "[" +
+                           std::to_string(cfg.board_size) + "]",
+                       "sims", min_time, [&](long long n) {
+                         for (long long i = 0; i < n; ++i) {
+                           leaf_mcts.reseed(seed++);
+                           auto pi = leaf_mcts.search(mid, true, 1.0f);
+                           do_not_optimize(pi);
+                         }
+                         return n * lcfg.num_simulations;
+                       });
+    l.params = {{"board", cfg.board_size},
+                {"simulations", cfg.num_simulations},
+                {"leaf_batch", leaf_batch}};
+    l.metrics = {{"states_per_call", calls > 0 ? static_cast<double>(states) / static_cast<double>(calls) : 0.0}};
+    out.push_back(l);
+  }
+
+  // Movimientos consecutivos de un juego: sin reuso, con reuso del subárbol,
+  // con reuso + PredictionCache delante del evaluador, con reuso + tabla de
+  // transposiciones en el árbol, con reuso sin el solver (poda de jugadas
+  // mortales y derrotas demostradas) para comparar la duración de los juegos
+  // con reuso + búsqueda Gumbel en la raíz y con reuso + juego greedy con
+  // corte anticipado (early_stop).
+  struct GameCase {
+    const char* suffix;
+    bool reuse;
+    bool cached;
+    bool transpositions;
+    bool solver;
+    bool gumbel;
+    bool early_stop;
+  };
+  for (const GameCase& gc : {GameCase{"", false, false, false, true, false, false},
+                             GameCase{"_reuse", true, false, false, true, false, false},
+                             GameCase{"_reuse_cache", true, true, false, true, false, false},
+                             GameCase{"_reuse_tt", true, false, true, true, false, false},
+                             GameCase{"_reuse_nosolver", true, false, false, false, false, false},
+                             GameCase{"_reuse_gumbel", true, false, false, true, true, false},
+                             GameCase{"_reuse_early", true, false, false, true, false, true}}) {
+    const bool reuse = gc.reuse;
+    const bool cached = gc.cached;
+    TrainConfig gcfg = cfg;
+    gcfg.reuse_tree = reuse;
+    gcfg.transpositions = gc.transpositions;
+    gcfg.solver = gc.solver;
+    gcfg.gumbel = gc.gumbel;
+    gcfg.early_stop = gc.early_stop;
+    long long calls = 0;
+    PredictionCache cache(cached ? (1u << 18) : 0u);
+    auto eval_one = [&calls, &cache](const SnakeEnv& env) {
+      Prediction p;
+      if (!cache.lookup(env.hash(), 1, p)) {
+        ++calls;
+        cache.store(env.hash(), 1, p);
+      }
+      return p;
+    };
+    MCTS::PredictFn counting = eval_one;
+    MCTS::BatchPredictFn counting_batch = [eval_one](const std::vector<const SnakeEnv*>& envs) {
+      std::vector<Prediction> preds;
+      preds.reserve(envs.size());
+      for (const SnakeEnv* e : envs) {
+        preds.push_back(eval_one(*e));
+      }
+      return preds;
+    };
+    MCTS game_mcts(gcfg, counting, counting_batch, 1);
+    SnakeEnv env(cfg.board_size, cfg.max_steps, 7);
+    long long moves = 0;
+    long long reused = 0;
+    long long games_done = 0;
+    long long sims = 0;
+    auto g = run_timed(std::string("mcts.game") + gc.suffix + "[" +
+                           std::to_string(cfg.board_size) + "]",
+                       "moves", min_time, [&](long long n) {
+                         for (long long i = 0; i < n; ++i) {
+                           if (env.is_done()) {
+                             env.reset(static_cast<uint32_t>(moves));
+                             game_mcts.clear_tree();
+                           }
+                           game_mcts.reseed(static_cast<uint32_t>(moves));
+                           auto pi = game_mcts.search(env, true, gc.early_stop ? 0.0f : 1.0f);
+                           reused += game_mcts.last_reused_visits();
+                           sims += game_mcts.last_simulations();
+                           const int action = gc.gumbel ? game_mcts.selected_action()
+                                                        : static_cast<int>(std::max_element(pi.begin(), pi.end()) -
+                                                                           pi.begin());
+                           env.step(action);
+                           game_mcts.advance(action, env);
+                           ++moves;
+                           games_done += env.is_done() ? 1 : 0;
+                         }
+                         return n;
+                       });
+    g.params = {{"board", cfg.board_size},
+                {"simulations", cfg.num_simulations},
+                {"reuse_tree", reuse ? 1.0 : 0.0},
+                {"cache", cached ? 1.0 : 0.0},
+                {"transpositions", gc.transpositions ? 1.0 : 0.0},
+                {"solver", gc.solver ? 1.0 : 0.0},
+                {"gumbel", gc.gumbel ? 1.0 : 0.0},
+                {"early_stop", gc.early_stop ? 1.0 : 0.0}};
+    g.metrics = {{"nn_states_per_move", static_cast<double>(calls) / static_cast<double>(moves)},
+                 {"reused_visits_per_move", static_cast<double>(reused) / static_cast<double>(moves)},
+                 {"sims_per_move", static_cast<double>(sims) / static_cast<double>(moves)},
+                 {"moves_per_game", static_cast<double>(moves) / static_cast<double>(std::max(1LL, games_done))}};
+    if (cached) {
+      g.metrics.push_back({"cache_hit_rate", cache.stats().hit_rate()});
+    }
+    out.push_back(g);
+  }
+}
+
+// Versión anterior de InferenceBatcher (mutex + deque + promise/future por
+// pedido), conservada solo como línea base del benchmark.
+class MutexInferenceBatcher {
+ public:
+  struct Stats {
+    long long states = 0;
+    long long batches = 0;
+  };
+
+  MutexInferenceBatcher(const PolicyValueModel& model, int max_batch, int wait_us)
+      : model_(model),
+        max_batch_(std::max(1, max_batch)),
+        wait_us_(std::max(1, wait_us)),
+        staging_(static_cast<std::size_t>(max_batch_) * static_cast<std::size_t>(model.input_dim())),
+        preds_(static_cast<std::size_t>(max_batch_)) {}
+
+  ~MutexInferenceBatcher() { stop(); }
+
+  void start() {
+    running_ = true;
+    worker_ = std::thread(&MutexInferenceBatcher::run_loop, this);
+  }
+
+  void stop() {
+    if (!running_.exchange(false)) {
+      return;
+    }
+    cv_.notify_all();
+    worker_.join();
+  }
+
+  Prediction predict(const SnakeEnv& env) {
+    Request req;
+    req.env = &env;
+    auto fut = req.promise.get_future();
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      queue_.push_back(std::move(req));
+      ++states_;
+    }
+    cv_.notify_one();
+    return fut.get();
+  }
+
+  [[nodiscard]] Stats stats() const { return {states_.load(), batches_.load()}; }
+
+ private:
+  struct Request {
+    const SnakeEnv* env = nullptr;
+    std::promise<Prediction> promise;
+  };
+
+  void run_loop() {
+    const std::size_t dim = static_cast<std::size_t>(model_.input_dim());
+    while (true) {
+      std::vector<Request> batch;
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [&]() { return !queue_.empty() || !running_.load(); });
+        if (queue_.empty() && !running_.load()) {
+          break;
+        }
+        const auto deadline =
+            std::chrono::steady_clock::now() + std::chrono::microseconds(wait_us_);
+        while (queue_.size() < static_cast<std::size_t>(max_batch_) && running_.load()) {
+          if (cv_.wait_until(lock, deadline) == std::cv_status::timeout) {
+            break;
+          }
+        }
+        const std::size_t take =
+            std::min<std::size_t>(queue_.size(), static_cast<std::size_t>(max_batch_));
+        for (std::size_t i = 0; i < take; ++i) {
+          batch.emplace_back(std::move(queue_.front()));
+          queue_.pop_front();
+        }
+      }
+      for (std::size_t i = 0; i < batch.size(); ++i) {
+        batch[i].env->encode_state(staging_.data() + i * dim);
+      }
+      model_.predict_batch(staging_.data(), static_cast<int64_t>(batch.size()), preds_.data());
+      for (std::size_t i = 0; i < batch.size(); ++i) {
+        batch[i].promise.set_value(preds_[i]);
+      }
+      ++batches_;
+    }
+  }
+
+  const PolicyValueModel& model_;
+  int max_batch_;
+  int wait_us_;
+  std::vector<float> staging_;
+  std::vector<Prediction> preds_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<Request> queue_;
+  std::atomic<bool> running_{false};
+  std::thread worker_;
+  std::atomic<long long> states_{0};
+  std::atomic<long long> batches_{0};
+};
+
+template <typename Server, typename... Extra>
+void bench_batcher_impl(const std::string& prefix,
+                        const TrainConfig& cfg,
+                        const PolicyValueModel& model,
+                        double min_time,
+                        std::vector<BenchResult>& out,
+                        Extra... extra) {
+  for (const int producers : {1, 8, 32, 64, 128}) {
+    Server server(model, cfg.inference_batch_size, cfg.inference_wait_us, extra...);
+    server.start();
+
+    std::vector<std::vector<double>> lat(static_cast<std::size_t>(producers));
+    std::vector<std::thread> pool;
+    const auto t0 = Clock::now();
+    for (int p = 0; p < producers; ++p) {
+      pool.emplace_back([&, p]() {
+        const SnakeEnv env = midgame_env(cfg.board_size, static_cast<uint32_t>(p + 1));
+        auto& mine = lat[static_cast<std::size_t>(p)];
+        while (seconds_since(t0) < min_time) {
+          const auto t = Clock::now();
+          Prediction pred = server.predict(env);
+          do_not_optimize(pred);
+          mine.push_back(seconds_since(t) * 1e6);
+        }
+      });
+    }
+    for (auto& th : pool) {
+      th.join();
+    }
+    const double secs = seconds_since(t0);
+    server.stop();
+
+    std::vector<double> all;
+    for (auto& v : lat) {
+      all.insert(all.end(), v.begin(), v.end());
+    }
+    const auto st = server.stats();
+    BenchResult r;
+    r.name = prefix + ".roundtrip[p=" + std::to_string(producers) + "]";
+    r.unit = "requests";
+    r.iterations = static_cast<long long>(all.size());
+    r.seconds = secs;
+    r.params = {{"producers", producers},
+                {"max_batch", cfg.inference_batch_size},
+                {"wait_us", cfg.inference_wait_us}};
+    r.metrics = {{"latency_p50_us", percentile(all, 0.50)},
+                 {"latency_p99_us", percentile(all, 0.99)},
+                 {"avg_batch", st.batches > 0 ? static_cast<double>(st.states) / st.batches : 0.0}};
+    if constexpr (std::is_same_v<Server, InferenceBatcher>) {
+      r.metrics.push_back({"target_batch", st.target_batch});
+      r.metrics.push_back({"chosen_wait_us", st.wait_us});
+      r.metrics.push_back({"arrival_per_sec", st.arrival_per_sec});
+    }
+    out.push_back(r);
+  }
+}
+
+void bench_batcher(const TrainConfig& cfg,
+                   const PolicyValueModel& model,
+                   double min_time,
+                   std::vector<BenchResult>& out) {
+  bench_batcher_impl<InferenceBatcher>("batcher", cfg, model, min_time, out, 0);
+  bench_batcher_impl<InferenceBatcher>("batcher_adaptive", cfg, model, min_time, out,
+                                       std::max(1, cfg.inference_latency_cap_us));
+  bench_batcher_impl<MutexInferenceBatcher>("batcher_mutex", cfg, model, min_time, out);
+}
+
+void bench_predict_batch(const TrainConfig& cfg,
+                         const PolicyValueModel& model,
+                         double min_time,
+                         std::vector<BenchResult>& out) {
+  const SnakeEnv mid = midgame_env(cfg.board_size, 9);
+  for (const int bs : {1, 16, 64, 256}) {
+    std::vector<float> states(static_cast<std::size_t>(bs * model.input_dim()));
+    for (int i = 0; i < bs; ++i) {
+      mid.encode_state(states.data() + static_cast<std::size_t>(i * model.input_dim()));
+    }
+    std::vector<Prediction> preds(static_cast<std::size_t>(bs));
+    auto r = run_timed("model.predict_batch[bs=" + std::to_string(bs) + "]", "states", min_time,
+                       [&](long long n) {
+                         for (long long i = 0; i < n; ++i) {
+                           model.predict_batch(states.data(), bs, preds.data());
+                           do_not_optimize(preds.data());
+                         }
+                         return n * bs;
+                       });
+    r.params = {{"batch", bs}, {"channels", cfg.model_channels}, {"blocks", cfg.model_blocks}};
+    out.push_back(r);
+  }
+}
+
+// Posiciones de partidas al azar con política uniforme, para llenar buffers.
+std::vector<TrainingExample> random_examples(const TrainConfig& cfg, std::size_t fill) {
+  std::vector<TrainingExample> examples;
+  SnakeEnv env(cfg.board_size, cfg.max_steps, 1);
+  std::mt19937 rng(2);
+  std::uniform_int_distribution<int> act(0, 3);
+  while (examples.size() < fill) {
+    TrainingExample ex;
+    ex.state = env.pack_state();
+    ex.policy = {0.25f, 0.25f, 0.25f, 0.25f};
+    examples.push_back(std::move(ex));
+    env.step(act(rng));
+    if (env.is_done()) {
+      env.reset(static_cast<uint32_t>(examples.size()));
+    }
+  }
+  return examples;
+}
+
+void bench_replay(const TrainConfig& cfg, double min_time, std::vector<BenchResult>& out) {
+  const std::size_t fill = 50000;
+  ReplayBuffer buffer(fill, cfg.board_size);
+  const std::vector<TrainingExample> examples = random_examples(cfg, fill);
+  std::mt19937 rng(2);
+  buffer.add_many(examples);
+
+  const std::size_t bs = static_cast<std::size_t>(cfg.batch_size);
+  auto r = run_timed("replay.sample[bs=" + std::to_string(bs) + "]", "examples", min_time,
+                     [&](long long n) {
+                       for (long long i = 0; i < n; ++i) {
+                         auto batch = buffer.sample(bs, rng);
+                         do_not_optimize(batch.data());
+                       }
+                       return n * static_cast<long long>(bs);
+                     });
+  r.params = {{"batch", static_cast<double>(bs)}, {"buffer", static_cast<double>(fill)}};
+  out.push_back(r);
+
+  // Muestreo + decodificación en buffers de batch reusados (lo que hacen los
+  // loaders del trainer): una pasada, sin reservas por batch.
+  std::vector<float> states(bs * static_cast<std::size_t>(4 * cfg.board_size * cfg.board_size));
+  std::vector<float> policies(bs * 4);
+  std::vector<float> outcomes(bs);
+  ReplayBuffer::SampleInfo scratch;
+  auto ri = run_timed("replay.sample_into[bs=" + std::to_string(bs) + "]", "examples", min_time,
+                      [&](long long n) {
+                        for (long long i = 0; i < n; ++i) {
+                          buffer.sample_into(bs, rng, states.data(), policies.data(), outcomes.data(), &scratch);
+                          do_not_optimize(states.data());
+                        }
+                        return n * static_cast<long long>(bs);
+                      });
+  ri.params = {{"batch", static_cast<double>(bs)}, {"buffer", static_cast<double>(fill)}};
+  out.push_back(ri);
+
+  // Priorizado: muestreo por sum-tree más la actualización de prioridades de
+  // cada paso de entrenamiento (losses sintéticas).
+  ReplayBuffer prioritized(fill, cfg.board_size, true, cfg.priority_alpha, cfg.priority_beta);
+  prioritized.add_many(examples);
+  ReplayBuffer::SampleInfo info;
+  std::vector<float> losses(bs);
+  std::uniform_real_distribution<float> loss(0.0f, 2.0f);
+  auto rp = run_timed("replay.sample_prioritized[bs=" + std::to_string(bs) + "]", "examples", min_time,
+                      [&](long long n) {
+                        for (long long i = 0; i < n; ++i) {
+                          auto batch = prioritized.sample(bs, rng, &info);
+                          for (float& l : losses) {
+                            l = loss(rng);
+                          }
+                          prioritized.update_priorities(info, losses.data());
+                          do_not_optimize(batch.data());
+                        }
+                        return n * static_cast<long long>(bs);
+                      });
+  rp.params = {{"batch", static_cast<double>(bs)}, {"buffer", static_cast<double>(fill)}};
+  out.push_back(rp);
+
+  // Muestreo mientras hilos de self-play insertan juegos de 64 posiciones
+  // (un juego por add_many, como el trainer). shards=1 es el lock único de antes.
+  const std::vector<TrainingExample> game(examples.begin(), examples.begin() + 64);
+  for (const int shards : {1, cfg.replay_shards}) {
+    ReplayBuffer sharded(fill, cfg.board_size, false, cfg.priority_alpha, cfg.priority_beta, shards);
+    sharded.add_many(examples);
+    std::atomic<bool> stop{false};
+    std::atomic<long long> inserted{0};
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 4; ++w) {
+      writers.emplace_back([&]() {
+        while (!stop.load(std::memory_order_relaxed)) {
+          sharded.add_many(game);
+          inserted.fetch_add(static_cast<long long>(game.size()), std::memory_order_relaxed);
+        }
+      });
+    }
+    auto rc = run_timed("replay.sample_concurrent[shards=" + std::to_string(shards) + "]", "examples", min_time,
+                        [&](long long n) {
+                          for (long long i = 0; i < n; ++i) {
+                            auto batch = sharded.sample(bs, rng);
+                            do_not_optimize(batch.data());
+                          }
+                          return n * static_cast<long long>(bs);
+                        });
+    stop.store(true);
+    for (auto& th : writers) {
+      th.join();
+    }
+    rc.params = {{"batch", static_cast<double>(bs)}, {"shards", static_cast<double>(shards)}, {"writers", 4.0}};
+    rc.metrics = {{"inserted_per_sec", static_cast<double>(inserted.load()) / rc.seconds}};
+    out.push_back(rc);
+  }
+}
+
+// Pasos de entrenamiento completos (batch + forward/backward + AdamW):
+// loaders=0 arma cada batch en el hilo de train; con loaders el batch
+// siguiente se arma mientras corre el paso actual.
+void bench_train(const TrainConfig& cfg, PolicyValueModel& model, double min_time, std::vector<BenchResult>& out) {
+  const std::size_t fill = 50000;
+  ReplayBuffer buffer(fill, cfg.board_size);
+  buffer.add_many(random_examples(cfg, fill));
+
+  const long long bs = cfg.batch_size;
+  for (const int loaders : {0, std::max(1, cfg.prefetch_loaders)}) {
+    BatchPrefetcher loader(buffer, model, cfg.batch_size, cfg.prefetch_batches, loaders, 3);
+    loader.start();
+    auto r = run_timed("train.step[loaders=" + std::to_string(loaders) + "]", "examples", min_time,
+                       [&](long long n) {
+                         for (long long i = 0; i < n; ++i) {
+                           BatchPrefetcher::Slot* slot = loader.acquire();
+                           const LossStats ls = model.train_batch(slot->batch, cfg.lr, cfg.weight_decay);
+                           loader.release(slot);
+                           do_not_optimize(ls.total);
+                         }
+                         return n * bs;
+                       });
+    r.params = {{"batch", static_cast<double>(bs)},
+                {"loaders", static_cast<double>(loaders)},
+                {"slots", static_cast<double>(cfg.prefetch_batches)}};
+    out.push_back(r);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto args = parse_cli(argc, argv);
+
+  const std::string config_path = cli_get(args, "--config", "config/config_paper_20x20.yaml");
+  const std::string out_path = cli_get(args, "--out", "");
+  const std::string filter = cli_get(args, "--filter", "");
+  const double min_time = std::stod(cli_get(args, "--min_time", "0.5"));
+
+  TrainConfig cfg;
+  std::string err;
+  if (!load_config_file(config_path, cfg, err)) {
+    std::cerr << "[ERROR] " << err << "\n";
+    return 1;
+  }
+  if (cli_has(args, "--simulations")) {
+    cfg.num_simulations = std::max(1, std::stoi(cli_get(args, "--simulations", "200")));
+  }
+
+  auto enabled = [&](const std::string& group) {
+    return filter.empty() || filter.find(group) != std::string::npos ||
+           group.find(filter) != std::string::npos;
+  };
+
+  std::vector<BenchResult> results;
+  if (enabled("env")) {
+    bench_env(10, min_time, results);
+    bench_env(20, min_time, results);
+  }
+  if (enabled("mcts")) {
+    bench_mcts(cfg, min_time, results);
+  }
+
+  std::string device = "none";
+  if (enabled("batcher") || enabled("model") || enabled("train")) {
+    PolicyValueModel model(cfg.board_size, cfg.model_channels, cfg.model_blocks,
+                           static_cast<uint32_t>(cfg.seed), cfg.lr, cfg.weight_decay);
+    device = model.device_string();
+    if (enabled("model")) {
+      bench_predict_batch(cfg, model, min_time, results);
+    }
+    if (enabled("batcher")) {
+      bench_batcher(cfg, model, min_time, results);
+    }
+    // Último: entrena y cambia los pesos del modelo.
+    if (enabled("train")) {
+      bench_train(cfg, model, min_time, results);
+    }
+  }
+  if (enabled("replay")) {
+    bench_replay(cfg, min_time, results);
+  }
+
+  const std::vector<std::pair<std::string, std::string>> meta = {
+      {"config", config_path},
+      {"label", cli_get(args, "--label", "")},
+      {"device", device},
+      {"hw_threads", std::to_string(std::thread::hardware_concurrency())},
+      {"min_time", cli_get(args, "--min_time", "0.5")},
+  };
+
+  if (out_path.empty()) {
+    write_json(std::cout, meta, results);
+    return 0;
+  }
+  std::ofstream os(out_path);
+  if (!os) {
+    std::cerr << "[ERROR] No se pudo escribir: " << out_path << "\n";
+    return 1;
+  }
+  write_json(os, meta, results);
+  std::cerr << "[OK] Benchmarks escritos en: " << out_path << "\n";
+  return 0;
+}
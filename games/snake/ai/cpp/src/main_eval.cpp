@@ -67,12 +67,15 @@ int main(int argc, char** argv) {
     const uint32_t seed = static_cast<uint32_t>(cfg.seed + g * 97);
     SnakeEnv env(cfg.board_size, cfg.max_steps, seed);
 
+    MCTS mcts(cfg, model, seed);
+
     int move = 0;
     while (!env.is_done()) {
-      MCTS mcts(cfg, model, seed + static_cast<uint32_t>(move * 19 + 11));
+      mcts.reseed(seed + static_cast<uint32_t>(move * 19 + 11));
       auto pi = mcts.search(env, false, 0.0f);
-      const int action = argmax4(pi);
+      const int action = cfg.gumbel ? mcts.selected_action() : argmax4(pi);
       env.step(action);
+      mcts.advance(action, env);
       ++move;
       if (move > cfg.max_steps + 8) {
         break;
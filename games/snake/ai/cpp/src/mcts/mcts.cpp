@@ -17,7 +17,29 @@ MCTS::MCTS(const TrainConfig& cfg, PredictFn predict_fn, BatchPredictFn batch_fn
       rng_(seed) {}
 
 MCTS::MCTS(const TrainConfig& cfg, const PolicyValueModel& model, uint32_t seed)
-    : MCTS(cfg, [&model](const std::vector<float>& s) { return model.predict(s); }, seed) {}
+    : MCTS(cfg,
+           [&model, buf = std::vector<float>(static_cast<std::size_t>(model.input_dim()))](
+               const SnakeEnv& env) mutable {
+             if (env.state_size() != model.input_dim()) {
+               return Prediction{};
+             }
+             env.encode_state(buf.data());
+             return model.predict(buf.data());
+           },
+           [&model, buf = std::vector<float>()](const std::vector<const SnakeEnv*>& envs) mutable {
+             std::vector<Prediction> out(envs.size());
+             const std::size_t dim = static_cast<std::size_t>(model.input_dim());
+             buf.resize(envs.size() * dim);
+             for (std::size_t i = 0; i < envs.size(); ++i) {
+               if (envs[i]->state_size() != model.input_dim()) {
+                 return out;
+               }
+               envs[i]->encode_state(buf.data() + i * dim);
+             }
+             model.predict_batch(buf.data(), static_cast<int64_t>(envs.size()), out.data());
+             return out;
+           },
+           seed) {}
 
 std::array<float, 4> MCTS::normalize_masked(const std::array<float, 4>& raw,
                                             const std::array<uint8_t, 4>& mask) {
@@ -53,84 +75,92 @@ std::array<float, 4> MCTS::normalize_masked(const std::array<float, 4>& raw,
 }
 
 float MCTS::expand(Node& node) {
-  node.valid_mask = node.env.valid_action_mask();
-
-  // Si hay food stochasticity Y tenemos batch predict, enviamos todo junto
-  // (estado original + k alternativas de comida) en una sola llamada batch.
-  // Esto elimina k round-trips secuenciales al servidor de inferencia.
-  if (node.food_eaten && cfg_.food_samples > 1 && batch_predict_fn_) {
-    std::vector<Point> free = node.env.free_cells();
-    const int k = free.empty() ? 0 : std::min(cfg_.food_samples - 1, static_cast<int>(free.size()));
-
-    // Construir batch: [estado_original, alt_1, alt_2, ..., alt_k]
-    std::vector<std::vector<float>> batch_states;
-    batch_states.reserve(static_cast<std::size_t>(1 + k));
-    batch_states.push_back(node.env.get_state());
-
-    if (k > 0) {
-      std::shuffle(free.begin(), free.end(), rng_);
-      for (int i = 0; i < k; ++i) {
-        SnakeEnv alt = node.env;
-        alt.set_food(free[static_cast<std::size_t>(i)]);
-        batch_states.push_back(alt.get_state());
-      }
-    }
-
-    auto preds = batch_predict_fn_(batch_states);
-    node.priors = normalize_masked(preds[0].policy, node.valid_mask);
-    node.expanded = true;
-
-    float sum = 0.0f;
-    for (std::size_t i = 0; i < preds.size(); ++i) {
-      sum += preds[i].value;
-    }
-    return sum / static_cast<float>(preds.size());
-  }
+  // La comida ya no se promedia acá: los resultados de comida cuelgan como
+  // hijos de un nodo de azar (ver select_leaf) y cada uno se evalúa entero.
+  ++nn_states_;
+  return apply_leaf_prediction(node, predict_fn_(node.env));
+}
 
-  // Path normal (sin food stochasticity o sin batch predict).
-  Prediction pred = predict_fn_(node.env.get_state());
+float MCTS::apply_leaf_prediction(Node& node, const Prediction& pred) {
+  node.valid_mask = legal_mask(node.env);
   node.priors = normalize_masked(pred.policy, node.valid_mask);
   node.expanded = true;
+  return pred.value;
+}
 
-  float value = pred.value;
-  if (node.food_eaten && cfg_.food_samples > 1) {
-    std::vector<Point> free = node.env.free_cells();
-    if (!free.empty()) {
-      const int k = std::min(cfg_.food_samples - 1, static_cast<int>(free.size()));
-      std::shuffle(free.begin(), free.end(), rng_);
-      float sum = value;
-      int used = 1;
-      for (int i = 0; i < k; ++i) {
-        SnakeEnv alt = node.env;
-        alt.set_food(free[static_cast<std::size_t>(i)]);
-        Prediction p2 = predict_fn_(alt.get_state());
-        sum += p2.value;
-        ++used;
-      }
-      value = sum / static_cast<float>(used);
+int MCTS::chance_outcome(const Node& node) const {
+  // Ensanchamiento progresivo: el nodo de azar abre un resultado nuevo cuando
+  // 1 + sqrt(N) lo permite (hasta food_samples y las celdas libres); si no,
+  // baja por el resultado menos visitado. Con visitas parejas el backup queda
+  // como el promedio sobre las comidas muestreadas (todas equiprobables).
+  int outcomes = 0;
+  int least = 0;
+  for (int o = 0; o < 4; ++o) {
+    if (node.children[static_cast<std::size_t>(o)] == kNoNode) {
+      break;
     }
+    if (node.edge_visits[static_cast<std::size_t>(o)] < node.edge_visits[static_cast<std::size_t>(least)]) {
+      least = o;
+    }
+    ++outcomes;
+  }
+  int allowed = 1;
+  while (allowed * allowed <= node.visit_count) {
+    ++allowed;
   }
+  allowed = std::min({allowed, chance_limit(), node.env.free_cell_count()});
+  return outcomes < allowed ? outcomes : least;
+}
 
-  return value;
+Point MCTS::sample_outcome_food(const Node& node) {
+  // Celda libre uniforme distinta de las comidas de los resultados ya
+  // abiertos (chance_outcome garantiza que queda alguna).
+  std::uniform_int_distribution<int> dist(0, node.env.free_cell_count() - 1);
+  while (true) {
+    const Point p = node.env.free_cell(dist(rng_));
+    bool used = false;
+    for (int o = 0; o < 4 && !used; ++o) {
+      const NodeId child = node.children[static_cast<std::size_t>(o)];
+      used = child != kNoNode && arena_[child].env.food().x == p.x && arena_[child].env.food().y == p.y;
+    }
+    if (!used) {
+      return p;
+    }
+  }
 }
 
 int MCTS::select_action(const Node& node) const {
-  int best_action = 0;
-  float best_score = -1e30f;
-  const float n_parent = std::sqrt(std::max(1, node.visit_count));
+  // Con el solver se saltean los hijos con derrota demostrada; si no queda
+  // otro (la demostración del padre todavía no subió) se vuelve a mirar todo.
+  if (cfg_.solver) {
+    const int a = best_puct_child(node, true);
+    if (a >= 0) {
+      return a;
+    }
+  }
+  return std::max(0, best_puct_child(node, false));
+}
 
+int MCTS::best_puct_child(const Node& node, bool skip_proven_losses) const {
+  int best_action = -1;
+  float best_score = 0.0f;
+  const float n_parent = std::sqrt(std::max(1, node.visit_count));
   for (int a = 0; a < 4; ++a) {
     if (node.valid_mask[static_cast<std::size_t>(a)] == 0) {
       continue;
     }
 
-    const Node* child = node.children[static_cast<std::size_t>(a)].get();
-    const float q = child ? child->q() : 0.0f;
-    const int n_sa = child ? child->visit_count : 0;
+    const NodeId child = node.children[static_cast<std::size_t>(a)];
+    if (skip_proven_losses && visible_proof(child) < 0) {
+      continue;
+    }
+    const float q = child != kNoNode ? arena_[child].q() : 0.0f;
+    const int n_sa = cfg_.transpositions ? node.edge_visits[static_cast<std::size_t>(a)]
+                                         : (child != kNoNode ? arena_[child].visit_count : 0);
     const float u = cfg_.c_puct * node.priors[static_cast<std::size_t>(a)] * n_parent /
                     (1.0f + static_cast<float>(n_sa));
     const float score = q + u;
-    if (score > best_score) {
+    if (best_action < 0 || score > best_score) {
       best_score = score;
       best_action = a;
     }
@@ -138,21 +168,307 @@ int MCTS::select_action(const Node& node) const {
   return best_action;
 }
 
+std::array<uint8_t, 4> MCTS::legal_mask(const SnakeEnv& env) const {
+  return cfg_.solver ? env.safe_action_mask() : env.valid_action_mask();
+}
+
+bool MCTS::prove_dead_end(Node& node) {
+  // Sin jugada que sobreviva el próximo paso: derrota demostrada sin pedirle
+  // nada a la red. Es independiente de la comida (la cola nunca la tiene).
+  if (!cfg_.solver) {
+    return false;
+  }
+  const std::array<uint8_t, 4> mask = node.env.safe_action_mask();
+  if (mask != std::array<uint8_t, 4>{0, 0, 0, 0}) {
+    return false;
+  }
+  node.valid_mask = mask;
+  node.expanded = true;
+  node.proven = -1;
+  return true;
+}
+
+int MCTS::visible_proof(NodeId child) const {
+  if (child == kNoNode) {
+    return 0;
+  }
+  const Node& c = arena_[child];
+  if (c.terminal) {
+    return c.won ? 1 : -1;
+  }
+  // Sin nodos de azar (food_samples = 1), bajo un hijo que comió la comida
+  // nueva es una muestra del árbol: lo demostrado ahí no vale para el padre,
+  // salvo el callejón sin salida.
+  if (!c.chance && c.food_eaten && c.valid_mask != std::array<uint8_t, 4>{0, 0, 0, 0}) {
+    return 0;
+  }
+  return c.proven;
+}
+
+int MCTS::update_proof(NodeId id) {
+  Node& node = arena_[id];
+  if (node.proven != 0 || !node.expanded || node.terminal) {
+    return node.proven;
+  }
+  if (node.chance) {
+    // Lo demostrado bajo una comida muestreada no vale para las demás, salvo
+    // el callejón sin salida: safe_action_mask no depende de la comida.
+    for (int o = 0; o < 4; ++o) {
+      const NodeId child = node.children[static_cast<std::size_t>(o)];
+      if (child != kNoNode && arena_[child].proven < 0 &&
+          arena_[child].valid_mask == std::array<uint8_t, 4>{0, 0, 0, 0}) {
+        node.proven = -1;
+        break;
+      }
+    }
+    return node.proven;
+  }
+  // Un solo agente: gana si alguna jugada gana, pierde si todas pierden.
+  bool all_lost = true;
+  for (int a = 0; a < 4; ++a) {
+    if (node.valid_mask[static_cast<std::size_t>(a)] == 0) {
+      continue;
+    }
+    const int p = visible_proof(node.children[static_cast<std::size_t>(a)]);
+    if (p > 0) {
+      node.proven = 1;
+      return 1;
+    }
+    all_lost = all_lost && p < 0;
+  }
+  if (all_lost) {
+    node.proven = -1;
+  }
+  return node.proven;
+}
+
+void MCTS::propagate_proof(int path_begin, int path_end) {
+  // Sube por el camino mientras cada padre quede demostrado.
+  if (!cfg_.solver || path_end <= path_begin) {
+    return;
+  }
+  const NodeId leaf = path_[static_cast<std::size_t>(path_end - 1)];
+  if (!arena_[leaf].terminal && arena_[leaf].proven == 0) {
+    return;
+  }
+  for (int p = path_end - 2; p >= path_begin; --p) {
+    if (update_proof(path_[static_cast<std::size_t>(p)]) == 0) {
+      return;
+    }
+  }
+}
+
+void MCTS::init_root_search() {
+  root_init_pending_ = false;
+  if (cfg_.gumbel) {
+    init_gumbel();
+  } else if (root_noise_) {
+    add_dirichlet_noise(arena_[root_]);
+  }
+}
+
+void MCTS::init_gumbel() {
+  // Gumbel MuZero (Danihelka et al. 2022) en la raíz: se eligen m jugadas por
+  // top-k de g + logit (g ~ Gumbel(0,1) solo con ruido de entrenamiento) y el
+  // presupuesto se reparte por sequential halving. La secuencia dice, para
+  // cada simulación, cuántas visitas de esta búsqueda debe tener la jugada a
+  // visitar: así la selección no guarda estado y sirve igual con hojas en
+  // batch. Debajo de la raíz se sigue usando PUCT.
+  const Node& root = arena_[root_];
+  int legal = 0;
+  for (int a = 0; a < 4; ++a) {
+    gumbel_base_[static_cast<std::size_t>(a)] = root.edge_visits[static_cast<std::size_t>(a)];
+    gumbel_[static_cast<std::size_t>(a)] = 0.0f;
+    legal += root.valid_mask[static_cast<std::size_t>(a)] != 0 ? 1 : 0;
+  }
+  if (root_noise_) {
+    std::uniform_real_distribution<float> unif(1e-6f, 1.0f - 1e-6f);
+    for (int a = 0; a < 4; ++a) {
+      gumbel_[static_cast<std::size_t>(a)] = -std::log(-std::log(unif(rng_)));
+    }
+  }
+
+  const int n = sim_limit_;
+  const int m = std::max(1, std::min(cfg_.gumbel_k, legal));
+  gumbel_seq_.clear();
+  gumbel_seq_.reserve(static_cast<std::size_t>(std::max(0, n)));
+  if (m == 1) {
+    for (int i = 0; i < n; ++i) {
+      gumbel_seq_.push_back(i);
+    }
+    return;
+  }
+  int log2m = 0;
+  while ((1 << log2m) < m) {
+    ++log2m;
+  }
+  std::array<int, 4> visits{0, 0, 0, 0};
+  int considered = m;
+  while (static_cast<int>(gumbel_seq_.size()) < n) {
+    const int extra = std::max(1, n / (log2m * considered));
+    for (int e = 0; e < extra && static_cast<int>(gumbel_seq_.size()) < n; ++e) {
+      for (int i = 0; i < considered && static_cast<int>(gumbel_seq_.size()) < n; ++i) {
+        gumbel_seq_.push_back(visits[static_cast<std::size_t>(i)]++);
+      }
+    }
+    considered = std::max(2, considered / 2);
+  }
+}
+
+int MCTS::search_visits(int action) const {
+  return arena_[root_].edge_visits[static_cast<std::size_t>(action)] -
+         gumbel_base_[static_cast<std::size_t>(action)];
+}
+
+std::array<float, 4> MCTS::gumbel_scores() const {
+  // logit + sigma(Q completada) por jugada de la raíz; -1e30 = descartada.
+  // Q completada: la Q del hijo si tiene visitas y si no la mezcla v_mix del
+  // valor de la raíz con las Q visitadas pesadas por el prior. Como valor de
+  // la raíz se usa su Q (ya es la red más las visitas, el mismo orden de
+  // magnitud que v_mix sin guardar la predicción aparte).
+  const Node& root = arena_[root_];
+  std::array<float, 4> scores{-1e30f, -1e30f, -1e30f, -1e30f};
+  std::array<float, 4> q{0.0f, 0.0f, 0.0f, 0.0f};
+  bool open = false;
+  for (int a = 0; a < 4; ++a) {
+    const NodeId child = root.children[static_cast<std::size_t>(a)];
+    open = open || (root.valid_mask[static_cast<std::size_t>(a)] != 0 && (!cfg_.solver || visible_proof(child) >= 0));
+  }
+
+  float sum_prior = 0.0f;
+  float sum_pq = 0.0f;
+  int sum_n = 0;
+  int max_n = 0;
+  for (int a = 0; a < 4; ++a) {
+    const NodeId child = root.children[static_cast<std::size_t>(a)];
+    const int n = root.edge_visits[static_cast<std::size_t>(a)];
+    if (root.valid_mask[static_cast<std::size_t>(a)] == 0 || child == kNoNode || n == 0) {
+      continue;
+    }
+    q[static_cast<std::size_t>(a)] = arena_[child].terminal ? (arena_[child].won ? 1.0f : -1.0f) : arena_[child].q();
+    sum_prior += root.priors[static_cast<std::size_t>(a)];
+    sum_pq += root.priors[static_cast<std::size_t>(a)] * q[static_cast<std::size_t>(a)];
+    sum_n += n;
+    max_n = std::max(max_n, n);
+  }
+  const float v_mix = sum_n > 0 && sum_prior > 0.0f
+                          ? (root.q() + static_cast<float>(sum_n) * sum_pq / sum_prior) / static_cast<float>(1 + sum_n)
+                          : root.q();
+
+  float q_min = 1e30f;
+  float q_max = -1e30f;
+  for (int a = 0; a < 4; ++a) {
+    const NodeId child = root.children[static_cast<std::size_t>(a)];
+    if (root.valid_mask[static_cast<std::size_t>(a)] == 0 || (open && cfg_.solver && visible_proof(child) < 0)) {
+      continue;
+    }
+    if (child == kNoNode || root.edge_visits[static_cast<std::size_t>(a)] == 0) {
+      q[static_cast<std::size_t>(a)] = v_mix;
+    }
+    q_min = std::min(q_min, q[static_cast<std::size_t>(a)]);
+    q_max = std::max(q_max, q[static_cast<std::size_t>(a)]);
+    scores[static_cast<std::size_t>(a)] = 0.0f;
+  }
+
+  const float sigma = (kGumbelVisitInit + static_cast<float>(max_n)) * kGumbelValueScale;
+  for (int a = 0; a < 4; ++a) {
+    if (scores[static_cast<std::size_t>(a)] <= -1e30f) {
+      continue;
+    }
+    const float q01 = (q[static_cast<std::size_t>(a)] - q_min) / std::max(q_max - q_min, 1e-6f);
+    scores[static_cast<std::size_t>(a)] =
+        std::log(std::max(root.priors[static_cast<std::size_t>(a)], 1e-12f)) + sigma * q01;
+  }
+  return scores;
+}
+
+int MCTS::gumbel_root_action() const {
+  // Visitar, entre las jugadas con tantas visitas como pide la secuencia, la
+  // de mayor g + logit + sigma(q). Las descartadas por el halving quedan con
+  // menos visitas y no vuelven a coincidir. Si ninguna coincide (una jugada
+  // quedó demostrada perdida a mitad de búsqueda) se toma la menos visitada.
+  const std::array<float, 4> scores = gumbel_scores();
+  int done = 0;
+  for (int a = 0; a < 4; ++a) {
+    done += search_visits(a);
+  }
+  const int target = gumbel_seq_.empty()
+                         ? 0
+                         : gumbel_seq_[static_cast<std::size_t>(
+                               std::min(done, static_cast<int>(gumbel_seq_.size()) - 1))];
+  int best = -1;
+  float best_score = -1e30f;
+  int fallback = -1;
+  float fallback_score = -1e30f;
+  int fallback_visits = 0;
+  for (int a = 0; a < 4; ++a) {
+    if (scores[static_cast<std::size_t>(a)] <= -1e30f) {
+      continue;
+    }
+    const float s = scores[static_cast<std::size_t>(a)] + gumbel_[static_cast<std::size_t>(a)];
+    const int n = search_visits(a);
+    if (n == target && s > best_score) {
+      best_score = s;
+      best = a;
+    }
+    if (fallback < 0 || n < fallback_visits || (n == fallback_visits && s > fallback_score)) {
+      fallback = a;
+      fallback_score = s;
+      fallback_visits = n;
+    }
+  }
+  if (best >= 0) {
+    return best;
+  }
+  return fallback >= 0 ? fallback : select_action(arena_[root_]);
+}
+
+std::array<float, 4> MCTS::gumbel_policy() const {
+  // Objetivo de política mejorada: softmax(logit + sigma(Q completada)) sobre
+  // las jugadas legales, sin el ruido Gumbel. Una victoria demostrada gana.
+  std::array<float, 4> pi{0.0f, 0.0f, 0.0f, 0.0f};
+  const Node& root = arena_[root_];
+  for (int a = 0; cfg_.solver && a < 4; ++a) {
+    if (root.valid_mask[static_cast<std::size_t>(a)] != 0 &&
+        visible_proof(root.children[static_cast<std::size_t>(a)]) > 0) {
+      pi[static_cast<std::size_t>(a)] = 1.0f;
+      return pi;
+    }
+  }
+  const std::array<float, 4> scores = gumbel_scores();
+  const float mx = *std::max_element(scores.begin(), scores.end());
+  if (mx <= -1e30f) {
+    return {0.25f, 0.25f, 0.25f, 0.25f};
+  }
+  float sum = 0.0f;
+  for (int a = 0; a < 4; ++a) {
+    if (scores[static_cast<std::size_t>(a)] > -1e30f) {
+      pi[static_cast<std::size_t>(a)] = std::exp(scores[static_cast<std::size_t>(a)] - mx);
+      sum += pi[static_cast<std::size_t>(a)];
+    }
+  }
+  for (int a = 0; a < 4; ++a) {
+    pi[static_cast<std::size_t>(a)] /= sum;
+  }
+  return pi;
+}
+
 void MCTS::add_dirichlet_noise(Node& node) {
-  std::vector<int> valid;
+  std::array<int, 4> valid{};
+  std::size_t n_valid = 0;
   for (int a = 0; a < 4; ++a) {
     if (node.valid_mask[static_cast<std::size_t>(a)] != 0) {
-      valid.push_back(a);
+      valid[n_valid++] = a;
     }
   }
-  if (valid.empty()) {
+  if (n_valid == 0) {
     return;
   }
 
   std::gamma_distribution<float> gamma(cfg_.dirichlet_alpha, 1.0f);
-  std::vector<float> noise(valid.size(), 0.0f);
+  std::array<float, 4> noise{0.0f, 0.0f, 0.0f, 0.0f};
   float sum = 0.0f;
-  for (std::size_t i = 0; i < valid.size(); ++i) {
+  for (std::size_t i = 0; i < n_valid; ++i) {
     noise[i] = gamma(rng_);
     sum += noise[i];
   }
@@ -160,7 +476,7 @@ void MCTS::add_dirichlet_noise(Node& node) {
     return;
   }
 
-  for (std::size_t i = 0; i < valid.size(); ++i) {
+  for (std::size_t i = 0; i < n_valid; ++i) {
     const int a = valid[i];
     const float dn = noise[i] / sum;
     node.priors[static_cast<std::size_t>(a)] =
@@ -172,60 +488,609 @@ void MCTS::add_dirichlet_noise(Node& node) {
 std::array<float, 4> MCTS::search(const SnakeEnv& root_env,
                                   bool add_root_noise,
                                   float temperature) {
-  Node root(root_env, 1.0f);
-  const float root_value = expand(root);
-  root.visit_count = 1;
-  root.value_sum = root_value;
-
-  if (add_root_noise) {
-    add_dirichlet_noise(root);
-  }
-
-  for (int sim = 0; sim < cfg_.num_simulations; ++sim) {
-    Node* node = &root;
-    std::vector<Node*> path;
-    path.push_back(node);
-
-    while (node->expanded && !node->terminal) {
-      const int action = select_action(*node);
-      auto& child_slot = node->children[static_cast<std::size_t>(action)];
-      if (!child_slot) {
-        SnakeEnv env_next = node->env;
-        StepResult step = env_next.step(action);
-
-        child_slot = std::make_unique<Node>(env_next, node->priors[static_cast<std::size_t>(action)]);
-        child_slot->food_eaten = step.food_eaten;
-        child_slot->terminal = step.done;
-        child_slot->won = step.won;
+  return dispatch_board_size(root_env.board_size(), [&](auto b) {
+    return search_impl<decltype(b)::value>(root_env, add_root_noise, temperature);
+  });
+}
+
+template <int kBoard>
+MCTS::NodeId MCTS::select_leaf(NodeId root, float virtual_loss) {
+  // Desciende por PUCT agregando el camino a path_; en los nodos de azar baja
+  // por el resultado de comida que toque (chance_outcome). Con virtual_loss > 0 cada
+  // nodo recorrido cuenta ya como una visita perdida, para que las siguientes
+  // selecciones de la misma ronda se desvíen hacia otras hojas.
+  // La pérdida se aplica después de elegir la acción del nodo, así con una
+  // sola hoja por ronda la selección es idéntica a la secuencial.
+  // Con transposiciones, si la arista elegida tiene menos visitas que el nodo
+  // compartido al que lleva, la simulación se corta ahí y propaga la Q de ese
+  // nodo sin evaluar nada (regla de búsqueda en grafo): el hijo se devuelve
+  // pero NO queda en path_, y sus estadísticas no cambian.
+  const int vl_visit = virtual_loss > 0.0f ? 1 : 0;
+  NodeId id = root;
+  path_.push_back(id);
+
+  while (arena_[id].expanded && !arena_[id].terminal && arena_[id].proven == 0) {
+    const int action = arena_[id].chance                 ? chance_outcome(arena_[id])
+                       : cfg_.gumbel && id == root       ? gumbel_root_action()
+                                                         : select_action(arena_[id]);
+    arena_[id].visit_count += vl_visit;
+    arena_[id].value_sum -= virtual_loss;
+    int& edge = arena_[id].edge_visits[static_cast<std::size_t>(action)];
+    NodeId child = arena_[id].children[static_cast<std::size_t>(action)];
+    if (cfg_.transpositions && child != kNoNode && arena_[child].expanded && !arena_[child].terminal &&
+        arena_[child].proven == 0 && edge < arena_[child].visit_count) {
+      edge += 1;
+      return child;
+    }
+    edge += 1;
+    if (child == kNoNode) {
+      // El resultado 0 de un nodo de azar es la comida que salió en step; los
+      // demás la cambian por otra celda libre.
+      const bool outcome = arena_[id].chance;
+      const Point food = outcome && action > 0 ? sample_outcome_food(arena_[id]) : Point{};
+      // alloc puede crecer la arena: tomar referencias solo después.
+      child = arena_.alloc(outcome ? 1.0f : arena_[id].priors[static_cast<std::size_t>(action)]);
+      Node& c = arena_[child];
+      c.env = arena_[id].env;
+      if (outcome) {
+        if (action > 0) {
+          c.env.set_food(food);
+        }
+      } else {
+        StepResult step = c.env.step_fixed<kBoard>(action);
+        c.food_eaten = step.food_eaten;
+        c.terminal = step.done;
+        c.won = step.won;
+        // Comer abre un nodo de azar (expandido, sin red ni tabla) cuyos
+        // hijos son las posiciones de la comida nueva.
+        c.chance = c.food_eaten && !c.terminal && chance_limit() > 1;
+        c.expanded = c.chance;
+      }
+      if (cfg_.transpositions && !c.terminal && !c.chance) {
+        // Misma posición por otro orden de jugadas: colgar el nodo existente
+        // (con sus visitas y su expansión) y devolver el recién creado.
+        const NodeId shared = find_transposition(c.env);
+        if (shared != kNoNode) {
+          arena_.release(child);
+          child = shared;
+        } else {
+          c.in_table = table_.insert(table_key(c.env), child);
+        }
       }
+      arena_[id].children[static_cast<std::size_t>(action)] = child;
+      arena_[child].parents += 1;
+    }
 
-      node = child_slot.get();
-      path.push_back(node);
-      if (node->terminal) {
-        break;
+    id = child;
+    path_.push_back(id);
+  }
+  arena_[id].visit_count += vl_visit;
+  arena_[id].value_sum -= virtual_loss;
+  return id;
+}
+
+template <int kBoard>
+int MCTS::gather_round(NodeId root, int k) {
+  // Elige hasta k hojas con virtual loss y deja en batch_envs_ los estados a
+  // evaluar (uno por hoja). Devuelve cuántos.
+  path_.clear();
+  leaves_.clear();
+  batch_envs_.clear();
+
+  for (int j = 0; j < k; ++j) {
+    const std::size_t begin = path_.size();
+    const NodeId id = select_leaf<kBoard>(root, kVirtualLoss);
+    Node& leaf = arena_[id];
+    if (!leaf.terminal && leaf.pending) {
+      // Colisión con una hoja ya pedida en esta ronda: deshacer el virtual
+      // loss del camino y evaluar lo juntado hasta ahora.
+      for (std::size_t p = begin; p < path_.size(); ++p) {
+        arena_[path_[p]].visit_count -= 1;
+        arena_[path_[p]].value_sum += kVirtualLoss;
+        if (p + 1 < path_.size()) {
+          arena_[path_[p]].edge_visits[static_cast<std::size_t>(edge_action(path_[p], path_[p + 1]))] -= 1;
+        }
       }
+      path_.resize(begin);
+      break;
     }
 
+    PendingLeaf pl;
+    pl.node = id;
+    pl.path_begin = static_cast<int>(begin);
+    pl.path_end = static_cast<int>(path_.size());
+    pl.batch_begin = static_cast<int>(batch_envs_.size());
+    if (id != path_.back()) {
+      pl.value = leaf.q();  // transposición ya evaluada, fuera del camino
+    } else if (leaf.terminal) {
+      pl.value = leaf.won ? 1.0f : -1.0f;
+    } else if (leaf.proven != 0 || prove_dead_end(leaf)) {
+      pl.value = static_cast<float>(leaf.proven);
+    } else {
+      leaf.pending = true;
+      batch_envs_.push_back(&leaf.env);
+      pl.batch_count = 1;
+    }
+    leaves_.push_back(pl);
+  }
+  nn_states_ += static_cast<int>(batch_envs_.size());
+  return static_cast<int>(batch_envs_.size());
+}
+
+int MCTS::backup_round(const Prediction* preds) {
+  for (const PendingLeaf& pl : leaves_) {
+    float value = pl.value;
+    if (pl.batch_count > 0) {
+      Node& leaf = arena_[pl.node];
+      leaf.pending = false;
+      value = apply_leaf_prediction(leaf, preds[pl.batch_begin]);
+    }
+    // La visita ya se contó al descender: solo revertir la pérdida virtual.
+    for (int p = pl.path_begin; p < pl.path_end; ++p) {
+      arena_[path_[static_cast<std::size_t>(p)]].value_sum += kVirtualLoss + value;
+    }
+    propagate_proof(pl.path_begin, pl.path_end);
+  }
+  const int n = static_cast<int>(leaves_.size());
+  leaves_.clear();
+  return n;
+}
+
+template <int kBoard>
+void MCTS::search_leaf_batches(NodeId root) {
+  // Paralelismo de hojas: por ronda se eligen hasta leaf_batch_size hojas con
+  // virtual loss, se evalúan todas en una sola llamada batch_predict_fn_ y
+  // después se propagan los valores.
+  while (!search_done()) {
+    const int k = round_size();
+    std::vector<Prediction> preds;
+    if (gather_round<kBoard>(root, k) > 0) {
+      preds = batch_predict_fn_(batch_envs_);
+    }
+    sims_done_ += backup_round(preds.data());
+  }
+}
+
+void MCTS::start_search(const SnakeEnv& root_env, bool greedy) {
+  prepare_root(root_env);
+  sims_done_ = 0;
+  nn_states_ = 0;
+  greedy_ = greedy;
+  search_start_ = std::chrono::steady_clock::now();
+  // Una sola jugada segura: no hay nada que buscar (la política sería
+  // one-hot igual) y no se gasta ninguna evaluación.
+  forced_action_ = -1;
+  if (cfg_.solver) {
+    const std::array<uint8_t, 4> safe = root_env.safe_action_mask();
+    if (std::accumulate(safe.begin(), safe.end(), 0) == 1) {
+      forced_action_ = static_cast<int>(std::find(safe.begin(), safe.end(), 1) - safe.begin());
+    }
+  }
+}
+
+int MCTS::round_size() const {
+  // Hojas de la próxima ronda: cada una pide a lo sumo un estado a la red.
+  int k = std::min(std::max(1, cfg_.leaf_batch_size), sim_limit_ - sims_done_);
+  if (cfg_.search_nn_budget > 0) {
+    k = std::min(k, cfg_.search_nn_budget - nn_states_);
+  }
+  return std::max(1, k);
+}
+
+bool MCTS::search_done() const {
+  // Corte anytime: tope de simulaciones, presupuesto de tiempo o de estados
+  // de red, raíz ya demostrada (la política no cambia) y, en búsquedas
+  // greedy con early_stop, ventaja de visitas que las simulaciones restantes
+  // no pueden remontar (sin contar demostraciones que aparezcan después).
+  if (sims_done_ >= sim_limit_ || arena_[root_].proven != 0) {
+    return true;
+  }
+  int left = sim_limit_ - sims_done_;
+  if (cfg_.search_nn_budget > 0) {
+    if (nn_states_ >= cfg_.search_nn_budget) {
+      return true;
+    }
+    left = std::min(left, cfg_.search_nn_budget - nn_states_);
+  }
+  if (cfg_.search_time_us > 0 &&
+      std::chrono::steady_clock::now() - search_start_ >= std::chrono::microseconds(cfg_.search_time_us)) {
+    return true;
+  }
+  if (!cfg_.early_stop || !greedy_ || cfg_.gumbel) {
+    return false;
+  }
+  const Node& root = arena_[root_];
+  int best = 0;
+  int second = 0;
+  for (int a = 0; a < 4; ++a) {
+    if (root.valid_mask[static_cast<std::size_t>(a)] == 0) {
+      continue;
+    }
+    const int n = root.edge_visits[static_cast<std::size_t>(a)];
+    if (n > best) {
+      second = best;
+      best = n;
+    } else if (n > second) {
+      second = n;
+    }
+  }
+  return best - second > left;
+}
+
+void MCTS::begin_search(const SnakeEnv& root_env, bool add_root_noise, bool greedy) {
+  start_search(root_env, greedy);
+  root_noise_ = add_root_noise;
+  root_init_pending_ = true;
+  if (arena_[root_].expanded && forced_action_ < 0) {
+    init_root_search();
+  }
+}
+
+int MCTS::collect_leaves(std::vector<const SnakeEnv*>& out) {
+  // Una ronda puede quedar solo con hojas terminales (sin estados que
+  // evaluar): se propagan acá mismo y se sigue con la próxima.
+  if (forced_action_ >= 0) {
+    return 0;
+  }
+  while (!arena_[root_].expanded || !search_done()) {
+    // La primera ronda de un árbol nuevo expande solo la raíz (no cuenta
+    // como simulación, igual que en search()).
+    const bool root_round = !arena_[root_].expanded;
+    const int k = root_round ? 1 : round_size();
+    const int n = dispatch_board_size(arena_[root_].env.board_size(), [&](auto b) {
+      return gather_round<decltype(b)::value>(root_, k);
+    });
+    if (n > 0) {
+      out.insert(out.end(), batch_envs_.begin(), batch_envs_.end());
+      return n;
+    }
+    // Ronda resuelta sin red (terminales, demostrados o la raíz sin salida).
+    // root_round se toma antes de gather_round, que puede marcar expandida
+    // una raíz sin salida; mismo criterio que apply_evaluations.
+    const int leaves = backup_round(nullptr);
+    if (!root_round) {
+      sims_done_ += leaves;
+    }
+    if (root_init_pending_) {
+      init_root_search();
+    }
+  }
+  return 0;
+}
+
+void MCTS::apply_evaluations(const Prediction* preds) {
+  const bool root_round = !arena_[root_].expanded;
+  const int leaves = backup_round(preds);
+  if (!root_round) {
+    sims_done_ += leaves;
+  } else if (root_init_pending_) {
+    init_root_search();
+  }
+}
+
+std::array<float, 4> MCTS::finish_search(float temperature) const {
+  return root_policy(root_, temperature);
+}
+
+int MCTS::selected_action() const {
+  if (!cfg_.gumbel || forced_action_ >= 0) {
+    const std::array<float, 4> pi = root_policy(root_, 0.0f);
+    return static_cast<int>(std::max_element(pi.begin(), pi.end()) - pi.begin());
+  }
+  // La ganadora del halving: entre las más visitadas en esta búsqueda, la de
+  // mayor g + logit + sigma(q). Una victoria demostrada se juega siempre.
+  for (int a = 0; cfg_.solver && a < 4; ++a) {
+    if (arena_[root_].valid_mask[static_cast<std::size_t>(a)] != 0 &&
+        visible_proof(arena_[root_].children[static_cast<std::size_t>(a)]) > 0) {
+      return a;
+    }
+  }
+  const std::array<float, 4> scores = gumbel_scores();
+  int most = -1;
+  for (int a = 0; a < 4; ++a) {
+    if (scores[static_cast<std::size_t>(a)] > -1e30f) {
+      most = std::max(most, search_visits(a));
+    }
+  }
+  int best = 0;
+  float best_score = -1e30f;
+  for (int a = 0; a < 4; ++a) {
+    const float s = scores[static_cast<std::size_t>(a)] + gumbel_[static_cast<std::size_t>(a)];
+    if (scores[static_cast<std::size_t>(a)] > -1e30f && search_visits(a) == most && s > best_score) {
+      best_score = s;
+      best = a;
+    }
+  }
+  return best;
+}
+
+void MCTS::prepare_root(const SnakeEnv& root_env) {
+  // Cada simulación crea a lo sumo un nodo, o dos si come (nodo de azar y
+  // su primer resultado).
+  const std::size_t per_search =
+      static_cast<std::size_t>(chance_limit() > 1 ? 2 : 1) * static_cast<std::size_t>(cfg_.num_simulations) + 1;
+  const bool reuse = reuse_ready_ && root_ != kNoNode && same_position(arena_[root_].env, root_env);
+  reuse_ready_ = false;
+  if (cfg_.transpositions) {
+    table_.init(cfg_.reuse_tree ? kArenaSearches * per_search : per_search);
+  }
+  if (!reuse) {
+    arena_.reset();
+    table_.clear();
+    root_ = arena_.alloc(1.0f);
+    arena_[root_].env = root_env;
+    if (cfg_.transpositions) {
+      arena_[root_].in_table = table_.insert(table_key(root_env), root_);
+    }
+  } else if (arena_.live() + per_search > kArenaSearches * per_search) {
+    // El subárbol reusado sigue creciendo: podarlo para acotar la memoria.
+    prune_tree(kKeepSearches * per_search);
+  }
+  last_reused_visits_ = reuse ? arena_[root_].visit_count : 0;
+
+  // Reservar de antemano los nodos de una búsqueda (el tope completo si hay
+  // reuso) evita realocar la arena en mitad de la búsqueda.
+  arena_.reserve(cfg_.reuse_tree ? kArenaSearches * per_search : per_search);
+}
+
+template <int kBoard>
+std::array<float, 4> MCTS::search_impl(const SnakeEnv& root_env,
+                                       bool add_root_noise,
+                                       float temperature) {
+  start_search(root_env, temperature <= 1e-6f);
+
+  const NodeId root = root_;
+  if (forced_action_ >= 0) {
+    return root_policy(root, temperature);
+  }
+  if (!arena_[root].expanded) {
+    const float root_value = prove_dead_end(arena_[root]) ? -1.0f : expand(arena_[root]);
+    arena_[root].visit_count += 1;
+    arena_[root].value_sum += root_value;
+  }
+
+  root_noise_ = add_root_noise;
+  init_root_search();
+
+  if (cfg_.leaf_batch_size > 1 && batch_predict_fn_) {
+    search_leaf_batches<kBoard>(root);
+    return root_policy(root, temperature);
+  }
+
+  for (; !search_done(); ++sims_done_) {
+    path_.clear();
+    const NodeId id = select_leaf<kBoard>(root, 0.0f);
+
     float value = 0.0f;
-    if (node->terminal) {
-      value = node->won ? 1.0f : -1.0f;
+    if (id != path_.back()) {
+      value = arena_[id].q();  // transposición ya evaluada
+    } else if (arena_[id].terminal) {
+      value = arena_[id].won ? 1.0f : -1.0f;
+    } else if (arena_[id].proven != 0 || prove_dead_end(arena_[id])) {
+      value = static_cast<float>(arena_[id].proven);
     } else {
-      value = expand(*node);
+      value = expand(arena_[id]);
+    }
+
+    for (const NodeId n : path_) {
+      arena_[n].visit_count += 1;
+      arena_[n].value_sum += value;
+    }
+    propagate_proof(0, static_cast<int>(path_.size()));
+  }
+
+  return root_policy(root, temperature);
+}
+
+void MCTS::advance(int action, const SnakeEnv& next_env) {
+  reuse_ready_ = false;
+  if (!cfg_.reuse_tree || root_ == kNoNode || action < 0 || action > 3) {
+    return;
+  }
+  NodeId child = arena_[root_].children[static_cast<std::size_t>(action)];
+  if (child == kNoNode || arena_[child].terminal || !arena_[child].expanded) {
+    return;
+  }
+  NodeId chance = kNoNode;
+  if (arena_[child].chance) {
+    // Comió: sirve el resultado de azar cuya comida coincide con la del juego.
+    chance = child;
+    child = kNoNode;
+    for (int o = 0; o < 4 && child == kNoNode; ++o) {
+      const NodeId c = arena_[chance].children[static_cast<std::size_t>(o)];
+      if (c != kNoNode && arena_[c].expanded && same_position(arena_[c].env, next_env)) {
+        child = c;
+      }
+    }
+    if (child == kNoNode) {
+      return;
     }
+  } else if (!same_position(arena_[child].env, next_env)) {
+    // Comparar la posición completa cubre el caso de comida sin nodos de
+    // azar: el árbol muestreó su propia comida y solo sirve si coincide.
+    return;
+  }
+  // Las ramas hermanas y la raíz vieja vuelven a la lista libre de la arena
+  // sin copiar nada; el subárbol elegido queda en su lugar. Con
+  // transposiciones, lo que una rama hermana comparte con él sobrevive.
+  for (int a = 0; a < 4; ++a) {
+    const NodeId sibling = arena_[root_].children[static_cast<std::size_t>(a)];
+    if (a != action && sibling != kNoNode) {
+      release_subtree(sibling);
+    }
+  }
+  if (chance != kNoNode) {
+    for (int o = 0; o < 4; ++o) {
+      const NodeId other = arena_[chance].children[static_cast<std::size_t>(o)];
+      if (other != kNoNode && other != child) {
+        release_subtree(other);
+      }
+    }
+    arena_.release(chance);
+  }
+  forget(root_);
+  arena_.release(root_);
+  arena_[child].parents -= 1;
+  root_ = child;
+  reuse_ready_ = true;
+}
 
-    for (auto* n : path) {
-      n->visit_count += 1;
-      n->value_sum += value;
+void MCTS::release_subtree(NodeId id) {
+  // Suelta una arista hacia id. Un nodo vuelve a la lista libre (y suelta a
+  // sus hijos) recién cuando no le quedan padres: con transposiciones puede
+  // colgar de varios; sin ellas siempre tiene uno.
+  path_.clear();
+  path_.push_back(id);
+  while (!path_.empty()) {
+    const NodeId n = path_.back();
+    path_.pop_back();
+    Node& node = arena_[n];
+    if (--node.parents > 0) {
+      continue;
     }
+    for (const NodeId c : node.children) {
+      if (c != kNoNode) {
+        path_.push_back(c);
+      }
+    }
+    forget(n);
+    arena_.release(n);
   }
+}
 
+int MCTS::edge_action(NodeId parent, NodeId child) const {
+  const auto& children = arena_[parent].children;
+  return static_cast<int>(std::find(children.begin(), children.end(), child) - children.begin());
+}
+
+uint64_t MCTS::table_key(const SnakeEnv& env) {
+  // La profundidad entra a la clave: así el grafo no tiene ciclos (una
+  // serpiente corta puede repetir posición) y cada camino tiene largo finito.
+  return env.hash() ^ (static_cast<uint64_t>(env.steps()) * 0x9E3779B97F4A7C15ULL);
+}
+
+MCTS::NodeId MCTS::find_transposition(const SnakeEnv& env) const {
+  return table_.find(table_key(env), [&](NodeId id) { return same_position(arena_[id].env, env); });
+}
+
+void MCTS::forget(NodeId id) {
+  Node& node = arena_[id];
+  if (node.in_table) {
+    table_.erase(table_key(node.env), id);
+    node.in_table = false;
+  }
+}
+
+void MCTS::prune_tree(std::size_t max_nodes) {
+  // BFS desde la raíz: se conservan los primeros max_nodes nodos (los niveles
+  // menos profundos) y el resto vuelve a la lista libre sin mover memoria.
+  // Las visitas podadas siguen contadas en el padre; si se vuelve a elegir
+  // esa acción el hijo se crea de nuevo.
+  // Con transposiciones un nodo ya conservado puede aparecer otra vez por
+  // otro padre: la marca de época evita encolarlo dos veces.
+  ++mark_epoch_;
+  bfs_.clear();
+  bfs_.push_back(root_);
+  arena_[root_].mark = mark_epoch_;
+  for (std::size_t i = 0; i < bfs_.size(); ++i) {
+    Node& node = arena_[bfs_[i]];
+    for (NodeId& c : node.children) {
+      if (c == kNoNode || arena_[c].mark == mark_epoch_) {
+        continue;
+      }
+      if (bfs_.size() < max_nodes) {
+        arena_[c].mark = mark_epoch_;
+        bfs_.push_back(c);
+      } else {
+        release_subtree(c);
+        c = kNoNode;
+      }
+    }
+  }
+}
+
+std::size_t MCTS::reachable_nodes() const {
+  if (root_ == kNoNode) {
+    return 0;
+  }
+  // Recorrido aparte del de prune_tree (const, sin marcas de época): con
+  // transposiciones un nodo puede aparecer por varios padres.
+  std::vector<NodeId> seen{root_};
+  std::vector<bool> visited(static_cast<std::size_t>(root_) + 1, false);
+  visited[static_cast<std::size_t>(root_)] = true;
+  for (std::size_t i = 0; i < seen.size(); ++i) {
+    for (const NodeId c : arena_[seen[i]].children) {
+      if (c == kNoNode) {
+        continue;
+      }
+      const std::size_t k = static_cast<std::size_t>(c);
+      if (k >= visited.size()) {
+        visited.resize(k + 1, false);
+      }
+      if (!visited[k]) {
+        visited[k] = true;
+        seen.push_back(c);
+      }
+    }
+  }
+  return seen.size();
+}
+
+bool MCTS::same_position(const SnakeEnv& a, const SnakeEnv& b) {
+  if (a.board_size() != b.board_size() || a.snake_length() != b.snake_length() ||
+      a.direction() != b.direction() || a.steps() != b.steps() ||
+      a.steps_since_food() != b.steps_since_food() ||
+      a.food().x != b.food().x || a.food().y != b.food().y ||
+      a.occupancy() != b.occupancy()) {
+    return false;
+  }
+  const int len = static_cast<int>(a.snake_length());
+  for (int i = 0; i < len; ++i) {
+    const Point pa = a.body_point(i);
+    const Point pb = b.body_point(i);
+    if (pa.x != pb.x || pa.y != pb.y) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::array<float, 4> MCTS::root_policy(NodeId root, float temperature) const {
+  if (forced_action_ >= 0) {
+    std::array<float, 4> pi{0.0f, 0.0f, 0.0f, 0.0f};
+    pi[static_cast<std::size_t>(forced_action_)] = 1.0f;
+    return pi;
+  }
+  if (cfg_.gumbel) {
+    return gumbel_policy();
+  }
   std::array<float, 4> visits{0.0f, 0.0f, 0.0f, 0.0f};
+  std::array<float, 4> proven_visits{0.0f, 0.0f, 0.0f, 0.0f};
+  bool win_found = false;
+  bool any_open = false;
   for (int a = 0; a < 4; ++a) {
-    const auto* child = root.children[static_cast<std::size_t>(a)].get();
-    if (!child) {
+    const NodeId child = arena_[root].children[static_cast<std::size_t>(a)];
+    if (child == kNoNode) {
       continue;
     }
-    visits[static_cast<std::size_t>(a)] = static_cast<float>(child->visit_count);
+    const float v = static_cast<float>(
+        cfg_.transpositions ? arena_[root].edge_visits[static_cast<std::size_t>(a)] : arena_[child].visit_count);
+    const int proof = cfg_.solver ? visible_proof(child) : 0;
+    if (proof > 0 && !win_found) {
+      // Victoria demostrada: jugarla siempre, sin importar las visitas.
+      proven_visits = {0.0f, 0.0f, 0.0f, 0.0f};
+      win_found = true;
+    }
+    if (proof > 0 || !win_found) {
+      proven_visits[static_cast<std::size_t>(a)] = proof < 0 ? 0.0f : (proof > 0 ? std::max(1.0f, v) : v);
+    }
+    any_open = any_open || (proof >= 0 && v > 0.0f);
+    visits[static_cast<std::size_t>(a)] = v;
+  }
+  // Las derrotas demostradas salen del objetivo de política; si todo está
+  // perdido se deja la distribución de visitas tal cual.
+  if (win_found || any_open) {
+    visits = proven_visits;
   }
 
   std::array<float, 4> pi{0.0f, 0.0f, 0.0f, 0.0f};
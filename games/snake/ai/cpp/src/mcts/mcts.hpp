@@ -1,9 +1,10 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstdint>
 #include <functional>
-#include <memory>
 #include <random>
 #include <vector>
 
@@ -15,8 +16,10 @@ namespace alphasnake {
 
 class MCTS {
  public:
-  using PredictFn = std::function<Prediction(const std::vector<float>&)>;
-  using BatchPredictFn = std::function<std::vector<Prediction>(const std::vector<std::vector<float>>&)>;
+  // Los evaluadores reciben el entorno y codifican el estado ellos mismos
+  // (SnakeEnv::encode_state) en su propio buffer: sin vectores intermedios.
+  using PredictFn = std::function<Prediction(const SnakeEnv&)>;
+  using BatchPredictFn = std::function<std::vector<Prediction>(const std::vector<const SnakeEnv*>&)>;
 
   MCTS(const TrainConfig& cfg, PredictFn predict_fn, uint32_t seed = 123);
   MCTS(const TrainConfig& cfg, PredictFn predict_fn, BatchPredictFn batch_fn, uint32_t seed = 123);
@@ -26,41 +29,340 @@ class MCTS {
                               bool add_root_noise,
                               float temperature);
 
+  // Reusar la instancia entre movimientos (una por juego/hilo) mantiene la
+  // arena de nodos ya reservada; reseed replica el seed por movimiento.
+  void reseed(uint32_t seed) { rng_.seed(seed); }
+  // Tope de simulaciones de las próximas búsquedas (playout cap
+  // randomization: búsquedas rápidas entre las completas). Se acota a
+  // num_simulations, que sigue dimensionando la arena; <= 0 = num_simulations.
+  void set_simulation_limit(int n) {
+    sim_limit_ = n > 0 ? std::min(n, cfg_.num_simulations) : cfg_.num_simulations;
+  }
+
+  // API reanudable (máquina de estados) para multiplexar muchos juegos en un
+  // hilo sin bloquear en el evaluador:
+  //   begin_search(env, noise, greedy);
+  //   while ((n = collect_leaves(batch)) > 0) { ...evaluar...; apply_evaluations(preds); }
+  //   pi = finish_search(temperature);
+  // collect_leaves agrega a `out` los estados de la próxima ronda (hasta
+  // leaf_batch_size hojas con virtual loss) y devuelve cuántos agregó; 0 = la
+  // búsqueda terminó. Los punteros valen hasta apply_evaluations, que recibe
+  // una predicción por estado en el mismo orden. No usa predict_fn_.
+  // greedy = la jugada se elige por argmax (temperatura 0): habilita el corte
+  // por ventaja de cfg.early_stop, como search() con temperature = 0.
+  void begin_search(const SnakeEnv& root_env, bool add_root_noise, bool greedy = false);
+  int collect_leaves(std::vector<const SnakeEnv*>& out);
+  void apply_evaluations(const Prediction* preds);
+  [[nodiscard]] std::array<float, 4> finish_search(float temperature) const;
+
+  // Con cfg.gumbel la política devuelta es el objetivo de entrenamiento
+  // (softmax de logits + Q completada, ignora la temperatura) y la jugada a
+  // hacer es la ganadora del sequential halving: esta. Sin gumbel, el argmax
+  // de visitas.
+  [[nodiscard]] int selected_action() const;
+
+  // Árbol persistente: tras jugar `action` y llegar a `next_env`, el hijo
+  // correspondiente pasa a ser la raíz del próximo search() conservando sus
+  // visitas. Si el movimiento comió, solo se reusa si la comida muestreada en
+  // el árbol coincide con la del juego real; si no, el próximo search() parte
+  // de cero. Sin efecto con cfg.reuse_tree = false.
+  void advance(int action, const SnakeEnv& next_env);
+  void clear_tree() {
+    root_ = kNoNode;
+    reuse_ready_ = false;
+  }
+  // Visitas heredadas por la raíz al inicio del último search() (0 = árbol nuevo).
+  [[nodiscard]] int last_reused_visits() const { return last_reused_visits_; }
+  // Simulaciones y estados de red de la última búsqueda (menos que
+  // num_simulations si cortó antes; 0 si había una sola jugada segura).
+  [[nodiscard]] int last_simulations() const { return sims_done_; }
+  [[nodiscard]] int last_nn_states() const { return nn_states_; }
+  // Resultado demostrado de la raíz de la última búsqueda (cfg.solver):
+  // 1 victoria, -1 derrota, 0 sin demostrar.
+  [[nodiscard]] int root_proof() const { return root_ == kNoNode ? 0 : arena_[root_].proven; }
+  // Diagnóstico (tests): nodos vivos en la arena y nodos alcanzables desde la
+  // raíz. Tras advance/poda tienen que coincidir: lo demás volvió a la lista libre.
+  [[nodiscard]] std::size_t live_nodes() const { return arena_.live(); }
+  [[nodiscard]] std::size_t reachable_nodes() const;
+
  private:
+  using NodeId = int32_t;
+  static constexpr NodeId kNoNode = -1;
+
   struct Node {
-    explicit Node(const SnakeEnv& env_state, float prior = 0.0f)
-        : env(env_state), prior_from_parent(prior) {}
+    void reset(float prior) {
+      children = {kNoNode, kNoNode, kNoNode, kNoNode};
+      edge_visits = {0, 0, 0, 0};
+      priors = {0.0f, 0.0f, 0.0f, 0.0f};
+      valid_mask = {0, 0, 0, 0};
+      prior_from_parent = prior;
+      visit_count = 0;
+      value_sum = 0.0f;
+      parents = 0;
+      mark = 0;
+      proven = 0;
+      expanded = false;
+      terminal = false;
+      won = false;
+      food_eaten = false;
+      chance = false;
+      pending = false;
+      in_table = false;
+    }
 
     SnakeEnv env;
-    std::array<std::unique_ptr<Node>, 4> children{};
+    std::array<NodeId, 4> children{kNoNode, kNoNode, kNoNode, kNoNode};
+    // Visitas por arista N(s,a). Con transposiciones un hijo compartido junta
+    // visitas de varios padres, así que PUCT y la política de la raíz usan
+    // estas y no el visit_count del hijo.
+    std::array<int, 4> edge_visits{0, 0, 0, 0};
     std::array<float, 4> priors{0.0f, 0.0f, 0.0f, 0.0f};
     std::array<uint8_t, 4> valid_mask{0, 0, 0, 0};
 
     float prior_from_parent = 0.0f;
     int visit_count = 0;
     float value_sum = 0.0f;
+    int parents = 0;    // aristas entrantes (la raíz no tiene)
+    uint32_t mark = 0;  // época del último recorrido de prune_tree
+    // MCTS-solver: +1 victoria / -1 derrota demostradas, 0 = sin demostrar.
+    // Un nodo demostrado se trata como terminal: no se vuelve a buscar.
+    int8_t proven = 0;
 
     bool expanded = false;
     bool terminal = false;
     bool won = false;
     bool food_eaten = false;
+    // Nodo de azar: la posición justo después de comer. Sus hijos (slots
+    // 0..food_samples-1) son la misma posición con distintas comidas nuevas;
+    // no se evalúa con la red y su Q promedia las de los resultados.
+    bool chance = false;
+    bool pending = false;   // hoja esperando evaluación en la ronda actual
+    bool in_table = false;  // registrado en la tabla de transposiciones
 
     [[nodiscard]] float q() const {
       return visit_count > 0 ? (value_sum / static_cast<float>(visit_count)) : 0.0f;
     }
   };
 
+  // Arena de nodos por búsqueda: memoria contigua, hijos por índice y reset
+  // en bloque entre movimientos. La capacidad se conserva, así que en régimen
+  // estable una búsqueda no hace ninguna asignación de heap.
+  class NodeArena {
+   public:
+    NodeId alloc(float prior) {
+      if (!free_.empty()) {
+        const NodeId id = free_.back();
+        free_.pop_back();
+        nodes_[static_cast<std::size_t>(id)].reset(prior);
+        return id;
+      }
+      if (size_ == nodes_.size()) {
+        nodes_.emplace_back();
+      }
+      nodes_[size_].reset(prior);
+      return static_cast<NodeId>(size_++);
+    }
+    // Devuelve un nodo suelto (ramas descartadas al re-enraizar).
+    void release(NodeId id) { free_.push_back(id); }
+    void reserve(std::size_t n) { nodes_.reserve(n); }
+    void reset() {
+      size_ = 0;
+      free_.clear();
+    }
+    [[nodiscard]] std::size_t live() const { return size_ - free_.size(); }
+    Node& operator[](NodeId id) { return nodes_[static_cast<std::size_t>(id)]; }
+    const Node& operator[](NodeId id) const { return nodes_[static_cast<std::size_t>(id)]; }
+
+   private:
+    std::vector<Node> nodes_;
+    std::vector<NodeId> free_;
+    std::size_t size_ = 0;
+  };
+
+  // Tabla de transposiciones posición -> nodo: direccionamiento abierto con
+  // sondeo lineal y borrado por corrimiento hacia atrás (sin lápidas), de
+  // tamaño fijo y reservada una vez, como la arena.
+  class TranspositionTable {
+   public:
+    void init(std::size_t max_nodes) {
+      std::size_t cap = 1;
+      while (cap < 2 * max_nodes) {
+        cap <<= 1;
+      }
+      if (slots_.size() != cap) {
+        slots_.assign(cap, Slot{});
+        mask_ = cap - 1;
+        used_ = 0;
+      }
+    }
+    void clear() {
+      if (used_ > 0) {
+        std::fill(slots_.begin(), slots_.end(), Slot{});
+        used_ = 0;
+      }
+    }
+    template <typename Match>
+    [[nodiscard]] NodeId find(uint64_t key, Match&& match) const {
+      for (std::size_t i = key & mask_;; i = (i + 1) & mask_) {
+        const Slot& s = slots_[i];
+        if (s.id == kNoNode) {
+          return kNoNode;
+        }
+        if (s.key == key && match(s.id)) {
+          return s.id;
+        }
+      }
+    }
+    // false si la tabla está a media carga: el nodo sigue siendo válido, solo
+    // que no se comparte.
+    bool insert(uint64_t key, NodeId id) {
+      if (2 * (used_ + 1) > slots_.size()) {
+        return false;
+      }
+      std::size_t i = key & mask_;
+      while (slots_[i].id != kNoNode) {
+        i = (i + 1) & mask_;
+      }
+      slots_[i] = {key, id};
+      ++used_;
+      return true;
+    }
+    void erase(uint64_t key, NodeId id) {
+      std::size_t i = key & mask_;
+      while (slots_[i].id != id) {
+        if (slots_[i].id == kNoNode) {
+          return;
+        }
+        i = (i + 1) & mask_;
+      }
+      // Corrimiento hacia atrás: traer al hueco las entradas cuyo slot ideal
+      // queda antes de él, para que ningún sondeo se corte.
+      for (std::size_t j = (i + 1) & mask_; slots_[j].id != kNoNode; j = (j + 1) & mask_) {
+        const std::size_t ideal = slots_[j].key & mask_;
+        if (((j - ideal) & mask_) >= ((j - i) & mask_)) {
+          slots_[i] = slots_[j];
+          i = j;
+        }
+      }
+      slots_[i] = Slot{};
+      --used_;
+    }
+
+   private:
+    struct Slot {
+      uint64_t key = 0;
+      NodeId id = kNoNode;
+    };
+    std::vector<Slot> slots_;
+    std::size_t mask_ = 0;
+    std::size_t used_ = 0;
+  };
+
+  // Con reuso el subárbol vivo crece hasta kArenaSearches búsquedas de nodos;
+  // al podarlo se conservan como mucho kKeepSearches (BFS desde la raíz).
+  static constexpr std::size_t kArenaSearches = 4;
+  static constexpr std::size_t kKeepSearches = 2;
+  // Pérdida virtual por camino en vuelo (en unidades de valor, rango [-1, 1]).
+  static constexpr float kVirtualLoss = 1.0f;
+  // Transformación de Q de Gumbel MuZero: sigma(q) = (c_visit + max N) * c_scale * q,
+  // con q reescalada a [0, 1] entre las jugadas de la raíz.
+  static constexpr float kGumbelVisitInit = 50.0f;
+  static constexpr float kGumbelValueScale = 0.1f;
+
+  struct PendingLeaf {
+    NodeId node = kNoNode;
+    int path_begin = 0;
+    int path_end = 0;
+    int batch_begin = 0;
+    int batch_count = 0;  // 0 = hoja resuelta sin red, value ya conocido
+    float value = 0.0f;
+  };
+
   const TrainConfig cfg_;
   PredictFn predict_fn_;
   BatchPredictFn batch_predict_fn_;
   std::mt19937 rng_;
 
+  NodeArena arena_;
+  TranspositionTable table_;
+  uint32_t mark_epoch_ = 0;
+  std::vector<NodeId> path_;
+  std::vector<NodeId> bfs_;
+  std::vector<PendingLeaf> leaves_;
+  NodeId root_ = kNoNode;
+  bool reuse_ready_ = false;
+  int last_reused_visits_ = 0;
+  int sim_limit_ = cfg_.num_simulations;
+  int sims_done_ = 0;
+  int nn_states_ = 0;
+  int forced_action_ = -1;  // única jugada segura en la raíz: sin búsqueda
+  bool greedy_ = false;
+  std::chrono::steady_clock::time_point search_start_;
+  bool root_init_pending_ = false;
+  bool root_noise_ = false;
+
+  // Búsqueda Gumbel en la raíz: ruido Gumbel por jugada, visitas de la raíz
+  // al empezar (con reuso) y objetivo de visitas por simulación del
+  // sequential halving.
+  std::array<float, 4> gumbel_{0.0f, 0.0f, 0.0f, 0.0f};
+  std::array<int, 4> gumbel_base_{0, 0, 0, 0};
+  std::vector<int> gumbel_seq_;
+
+  // Estados de la ronda de hojas en curso (punteros a envs de la arena).
+  std::vector<const SnakeEnv*> batch_envs_;
+
+  // Búsqueda especializada por tamaño de tablero (dispatch_board_size): los
+  // step() del árbol usan la aritmética de índices constante del entorno.
+  template <int kBoard>
+  std::array<float, 4> search_impl(const SnakeEnv& root_env,
+                                   bool add_root_noise,
+                                   float temperature);
+
+  template <int kBoard>
+  NodeId select_leaf(NodeId root, float virtual_loss);
+  template <int kBoard>
+  int gather_round(NodeId root, int k);
+  int backup_round(const Prediction* preds);
+  template <int kBoard>
+  void search_leaf_batches(NodeId root);
+  void prepare_root(const SnakeEnv& root_env);
+  void start_search(const SnakeEnv& root_env, bool greedy);
+  [[nodiscard]] bool search_done() const;
+  [[nodiscard]] int round_size() const;
+
   float expand(Node& node);
+  float apply_leaf_prediction(Node& node, const Prediction& pred);
+  [[nodiscard]] int chance_outcome(const Node& node) const;
+  Point sample_outcome_food(const Node& node);
+  // Resultados de comida por nodo de azar: food_samples, acotado a los 4
+  // slots de hijos. 1 = seguir la comida que sale en step (sin nodos de azar).
+  [[nodiscard]] int chance_limit() const { return std::max(1, std::min(cfg_.food_samples, 4)); }
   int select_action(const Node& node) const;
+  // Hijo de mayor PUCT entre los legales (-1 si no queda ninguno).
+  [[nodiscard]] int best_puct_child(const Node& node, bool skip_proven_losses) const;
+  [[nodiscard]] std::array<uint8_t, 4> legal_mask(const SnakeEnv& env) const;
+  bool prove_dead_end(Node& node);
+  [[nodiscard]] int visible_proof(NodeId child) const;
+  int update_proof(NodeId id);
+  void propagate_proof(int path_begin, int path_end);
+  [[nodiscard]] int edge_action(NodeId parent, NodeId child) const;
+  [[nodiscard]] NodeId find_transposition(const SnakeEnv& env) const;
+  void forget(NodeId id);
+  [[nodiscard]] static uint64_t table_key(const SnakeEnv& env);
   void add_dirichlet_noise(Node& node);
+  void init_root_search();
+  void init_gumbel();
+  [[nodiscard]] int search_visits(int action) const;
+  [[nodiscard]] std::array<float, 4> gumbel_scores() const;
+  [[nodiscard]] int gumbel_root_action() const;
+  [[nodiscard]] std::array<float, 4> gumbel_policy() const;
 
   static std::array<float, 4> normalize_masked(const std::array<float, 4>& raw,
                                                const std::array<uint8_t, 4>& mask);
+  std::array<float, 4> root_policy(NodeId root, float temperature) const;
+  void release_subtree(NodeId id);
+  void prune_tree(std::size_t max_nodes);
+  static bool same_position(const SnakeEnv& a, const SnakeEnv& b);
 };
 
 }  // namespace alphasnake
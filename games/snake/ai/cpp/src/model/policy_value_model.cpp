@@ -1,14 +1,23 @@
 #include "model/policy_value_model.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
-#include <cstring>
 #include <filesystem>
 #include <iostream>
 
 namespace fs = std::filesystem;
 
 namespace alphasnake {
+namespace {
+
+// Versiones de pesos únicas en todo el proceso (0 = modelo sin inicializar).
+uint64_t next_weights_version() {
+  static std::atomic<uint64_t> counter{0};
+  return counter.fetch_add(1) + 1;
+}
+
+}  // namespace
 
 ResidualBlockImpl::ResidualBlockImpl(int channels)
     : conv1(torch::nn::Conv2dOptions(channels, channels, 3).padding(1).bias(false)),
@@ -121,6 +130,9 @@ void PolicyValueModel::init(int board_size,
 
   net_ = AlphaSnakeNet(board_size_, channels_, blocks_);
   net_->to(device_);
+  // Los batches reusados dependen del tablero y del device.
+  host_batch_ = TrainBatch{};
+  device_batch_ = TrainBatch{};
 
   // CUDA warmup: la primera operación CUDA inicializa el contexto
   // y cuDNN selecciona algoritmos (~300-500ms). Mejor hacerlo aquí
@@ -137,6 +149,7 @@ void PolicyValueModel::init(int board_size,
   optimizer_ = std::make_unique<torch::optim::AdamW>(
       net_->parameters(),
       torch::optim::AdamWOptions(lr).weight_decay(weight_decay));
+  version_.store(next_weights_version(), std::memory_order_release);
 }
 
 std::string PolicyValueModel::device_string() const {
@@ -147,8 +160,15 @@ std::string PolicyValueModel::device_string() const {
 }
 
 Prediction PolicyValueModel::predict(const std::vector<float>& state) const {
+  if (static_cast<int>(state.size()) != input_dim_) {
+    return Prediction{};
+  }
+  return predict(state.data());
+}
+
+Prediction PolicyValueModel::predict(const float* state) const {
   Prediction pred;
-  if (static_cast<int>(state.size()) != input_dim_ || !net_) {
+  if (state == nullptr || !net_) {
     return pred;
   }
 
@@ -159,7 +179,7 @@ Prediction PolicyValueModel::predict(const std::vector<float>& state) const {
   net_->eval();
 
   auto t = torch::from_blob(
-               const_cast<float*>(state.data()),
+               const_cast<float*>(state),
                {1, 4, board_size_, board_size_},
                torch::kFloat32)
                .to(device_);
@@ -193,88 +213,170 @@ std::vector<Prediction> PolicyValueModel::predict_batch(
     flat.insert(flat.end(), s.begin(), s.end());
   }
 
+  out.resize(static_cast<std::size_t>(bs));
+  predict_batch(flat.data(), bs, out.data());
+  return out;
+}
+
+void PolicyValueModel::predict_batch(const float* states, int64_t n, Prediction* out) const {
+  if (states == nullptr || n <= 0 || !net_) {
+    return;
+  }
+
   std::lock_guard<std::mutex> lock(infer_mu_);
   torch::InferenceMode guard;
   net_->eval();
 
   // .to(device_) ya crea un tensor nuevo en GPU — no necesitamos .clone()
   // cuando el destino es CUDA (la copia CPU→GPU implica nuevo storage).
-  auto x = torch::from_blob(flat.data(), {bs, 4, board_size_, board_size_}, torch::kFloat32)
+  auto x = torch::from_blob(const_cast<float*>(states), {n, 4, board_size_, board_size_},
+                            torch::kFloat32)
                .to(device_);
   auto pred = net_->forward(x);
   auto p = pred.first.to(torch::kCPU).contiguous();
   auto v = pred.second.to(torch::kCPU).contiguous();
 
-  out.resize(static_cast<std::size_t>(bs));
   const float* pptr = p.data_ptr<float>();
   const float* vptr = v.data_ptr<float>();
-  for (int64_t i = 0; i < bs; ++i) {
+  for (int64_t i = 0; i < n; ++i) {
     for (int a = 0; a < 4; ++a) {
-      out[static_cast<std::size_t>(i)].policy[static_cast<std::size_t>(a)] =
-          pptr[i * 4 + a];
+      out[i].policy[static_cast<std::size_t>(a)] = pptr[i * 4 + a];
     }
-    out[static_cast<std::size_t>(i)].value = vptr[i];
+    out[i].value = vptr[i];
   }
-  return out;
 }
 
 LossStats PolicyValueModel::train_batch(const std::vector<TrainingExample>& batch,
                                         float lr,
-                                        float weight_decay) {
-  LossStats stats{};
+                                        float weight_decay,
+                                        const float* weights,
+                                        float* example_losses) {
   if (batch.empty() || !net_ || !optimizer_) {
-    return stats;
+    return LossStats{};
   }
 
   std::lock_guard<std::mutex> lock(train_mu_);
-  net_->train();
-
-  auto& options = static_cast<torch::optim::AdamWOptions&>(optimizer_->param_groups()[0].options());
-  options.lr(lr);
-  options.weight_decay(weight_decay);
 
   const int64_t bs = static_cast<int64_t>(batch.size());
-  std::vector<float> states;
-  std::vector<float> targets_p;
-  std::vector<float> targets_v;
-  states.reserve(static_cast<std::size_t>(bs * input_dim_));
-  targets_p.reserve(static_cast<std::size_t>(bs * 4));
-  targets_v.reserve(static_cast<std::size_t>(bs));
-
-  for (const auto& ex : batch) {
-    if (static_cast<int>(ex.state.size()) != input_dim_) {
-      continue;
-    }
-    states.insert(states.end(), ex.state.begin(), ex.state.end());
-    for (int a = 0; a < 4; ++a) {
-      targets_p.push_back(ex.policy[static_cast<std::size_t>(a)]);
+  if (!host_batch_.states.defined() || host_batch_.states.size(0) < bs) {
+    host_batch_ = make_train_batch(bs);
+  }
+  // Una pasada: cada ejemplo empaquetado se decodifica directo en su fila y
+  // los objetivos van a sus tensores, sin buffers intermedios.
+  float* states = host_batch_.states.data_ptr<float>();
+  float* policies = host_batch_.policies.data_ptr<float>();
+  float* outcomes = host_batch_.outcomes.data_ptr<float>();
+  float* ws = host_batch_.weights.data_ptr<float>();
+  for (std::size_t i = 0; i < batch.size(); ++i) {
+    const TrainingExample& ex = batch[i];
+    SnakeEnv::decode_state(board_size_, ex.state, states + i * static_cast<std::size_t>(input_dim_));
+    std::copy(ex.policy.begin(), ex.policy.end(), policies + i * 4);
+    outcomes[i] = ex.outcome;
+    if (weights != nullptr) {
+      ws[i] = weights[i];
     }
-    targets_v.push_back(ex.outcome);
   }
+  host_batch_.size = bs;
+  host_batch_.weighted = weights != nullptr;
+  return train_locked(host_batch_, lr, weight_decay, example_losses);
+}
+
+TrainBatch PolicyValueModel::alloc_train_batch(int64_t capacity, const torch::TensorOptions& opts) const {
+  TrainBatch batch;
+  batch.states = torch::empty({capacity, 4, board_size_, board_size_}, opts);
+  batch.policies = torch::empty({capacity, 4}, opts);
+  batch.outcomes = torch::empty({capacity, 1}, opts);
+  batch.weights = torch::ones({capacity}, opts);
+  return batch;
+}
+
+TrainBatch PolicyValueModel::make_train_batch(int64_t capacity) const {
+  // Pinned solo sirve (y solo se puede pedir) con un device CUDA.
+  return alloc_train_batch(capacity,
+                           torch::TensorOptions().dtype(torch::kFloat32).pinned_memory(device_.is_cuda()));
+}
+
+LossStats PolicyValueModel::train_batch(const TrainBatch& batch,
+                                        float lr,
+                                        float weight_decay,
+                                        float* example_losses) {
+  if (batch.size <= 0 || !net_ || !optimizer_) {
+    return LossStats{};
+  }
+  std::lock_guard<std::mutex> lock(train_mu_);
+  return train_locked(batch, lr, weight_decay, example_losses);
+}
 
-  if (states.empty()) {
-    return stats;
+LossStats PolicyValueModel::train_locked(const TrainBatch& batch,
+                                         float lr,
+                                         float weight_decay,
+                                         float* example_losses) {
+  const int64_t n = batch.size;
+  auto x = batch.states.narrow(0, 0, n);
+  auto y_p = batch.policies.narrow(0, 0, n);
+  auto y_v = batch.outcomes.narrow(0, 0, n);
+  torch::Tensor w;
+  if (batch.weighted) {
+    w = batch.weights.narrow(0, 0, n);
+  }
+  if (device_.is_cuda()) {
+    // copy_ sobre tensores del device ya reservados: sin cudaMalloc ni
+    // tensores nuevos por paso, solo la transferencia.
+    if (!device_batch_.states.defined() || device_batch_.states.size(0) < n) {
+      device_batch_ = alloc_train_batch(n, torch::TensorOptions().dtype(torch::kFloat32).device(device_));
+    }
+    const bool async = batch.states.is_pinned();
+    x = device_batch_.states.narrow(0, 0, n).copy_(x, async);
+    y_p = device_batch_.policies.narrow(0, 0, n).copy_(y_p, async);
+    y_v = device_batch_.outcomes.narrow(0, 0, n).copy_(y_v, async);
+    if (w.defined()) {
+      w = device_batch_.weights.narrow(0, 0, n).copy_(w, async);
+    }
   }
+  // optimize termina con item(), que sincroniza el stream: las copias
+  // asíncronas desde los buffers pinned ya terminaron al volver.
+  return optimize(x, y_p, y_v, w, lr, weight_decay, example_losses);
+}
 
-  const int64_t real_bs = static_cast<int64_t>(targets_v.size());
+LossStats PolicyValueModel::optimize(const torch::Tensor& x,
+                                     const torch::Tensor& y_p,
+                                     const torch::Tensor& y_v,
+                                     const torch::Tensor& w,
+                                     float lr,
+                                     float weight_decay,
+                                     float* example_losses) {
+  LossStats stats{};
+  net_->train();
 
-  // .to(device_) con CUDA ya crea tensor nuevo — .clone() es redundante.
-  auto x = torch::from_blob(states.data(), {real_bs, 4, board_size_, board_size_}, torch::kFloat32)
-               .to(device_);
-  auto y_p = torch::from_blob(targets_p.data(), {real_bs, 4}, torch::kFloat32).to(device_);
-  auto y_v = torch::from_blob(targets_v.data(), {real_bs, 1}, torch::kFloat32).to(device_);
+  auto& options = static_cast<torch::optim::AdamWOptions&>(optimizer_->param_groups()[0].options());
+  options.lr(lr);
+  options.weight_decay(weight_decay);
 
   auto out = net_->forward(x);
   auto pred_p = out.first;
   auto pred_v = out.second;
 
-  auto p_loss = -(y_p * (pred_p + 1e-8).log()).sum(1).mean();
-  auto v_loss = torch::mse_loss(pred_v, y_v);
+  // Las filas con política en cero (búsqueda rápida) no aportan a la
+  // entropía cruzada y tampoco cuentan en el promedio: cada fila con objetivo
+  // suma 1, así que y_p.sum() es la cantidad de filas con objetivo.
+  auto p_rows = -(y_p * (pred_p + 1e-8).log()).sum(1);
+  auto v_rows = (pred_v - y_v).pow(2).squeeze(1);
+  if (example_losses != nullptr) {
+    // Directo al buffer del llamador, sin tensor CPU intermedio.
+    torch::from_blob(example_losses, {p_rows.size(0)}, torch::kFloat32).copy_((p_rows + v_rows).detach());
+  }
+  if (w.defined()) {
+    p_rows = p_rows * w;
+    v_rows = v_rows * w;
+  }
+  auto p_loss = p_rows.sum() / y_p.sum().clamp_min(1.0);
+  auto v_loss = v_rows.mean();
   auto total = p_loss + v_loss;
 
   optimizer_->zero_grad();
   total.backward();
   optimizer_->step();
+  version_.store(next_weights_version(), std::memory_order_release);
 
   stats.total = total.item<float>();
   stats.policy = p_loss.item<float>();
@@ -291,6 +393,10 @@ void PolicyValueModel::copy_from(const PolicyValueModel& other) {
     init(other.board_size_, other.channels_, other.blocks_, 42, 1e-3f, 1e-4f);
   }
 
+  // Con el pipeline asíncrono los dos modelos pueden estar en uso: no pisar
+  // pesos en mitad de una inferencia ni leer el origen en mitad de un paso
+  // del optimizador.
+  std::scoped_lock lock(train_mu_, infer_mu_, other.train_mu_);
   torch::NoGradGuard no_grad;
 
   auto dst_params = net_->named_parameters(true /* recurse */);
@@ -310,6 +416,7 @@ void PolicyValueModel::copy_from(const PolicyValueModel& other) {
       t->copy_(item.value());
     }
   }
+  version_.store(other.weights_version(), std::memory_order_release);
 }
 
 void PolicyValueModel::reset_optimizer(float lr, float weight_decay) {
@@ -327,6 +434,9 @@ bool PolicyValueModel::save(const std::string& path, std::string& error) const {
     return false;
   }
 
+  // Los pesos solo cambian bajo train_mu_ (train_batch, copy_from): guardar
+  // en segundo plano no lee un estado a medias.
+  std::lock_guard<std::mutex> lock(train_mu_);
   try {
     std::error_code ec;
     fs::create_directories(fs::path(path).parent_path(), ec);
@@ -351,6 +461,7 @@ bool PolicyValueModel::load(const std::string& path, std::string& error) {
     archive.load_from(path);
     net_->load(archive);
     net_->to(device_);
+    version_.store(next_weights_version(), std::memory_order_release);
     return true;
   } catch (const c10::Error& e) {
     error = std::string("load archive fallo: ") + e.what();
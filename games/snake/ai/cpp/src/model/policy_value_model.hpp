@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <mutex>
@@ -52,6 +53,19 @@ struct AlphaSnakeNetImpl : torch::nn::Module {
 };
 TORCH_MODULE(AlphaSnakeNet);
 
+// Batch de entrenamiento armado fuera del paso de optimización (p. ej. por
+// BatchPrefetcher): tensores CPU con capacidad fija, reusados entre pasos y
+// en memoria pinned si el modelo está en CUDA (copia asíncrona al device).
+// Se usan las primeras `size` filas.
+struct TrainBatch {
+  torch::Tensor states;    // [capacity, 4, N, N]
+  torch::Tensor policies;  // [capacity, 4]
+  torch::Tensor outcomes;  // [capacity, 1]
+  torch::Tensor weights;   // [capacity], importance sampling
+  int64_t size = 0;
+  bool weighted = false;   // false = ignorar weights
+};
+
 class PolicyValueModel {
  public:
   PolicyValueModel() = default;
@@ -73,11 +87,37 @@ class PolicyValueModel {
   [[nodiscard]] int input_dim() const { return input_dim_; }
   [[nodiscard]] bool uses_cuda() const { return device_.is_cuda(); }
   [[nodiscard]] std::string device_string() const;
+  // Identifica el contenido de los pesos: cambia con init/train_batch/load y
+  // copy_from hereda el del origen (mismos pesos, mismas predicciones). Las
+  // entradas del PredictionCache quedan atadas a esta versión.
+  [[nodiscard]] uint64_t weights_version() const { return version_.load(std::memory_order_acquire); }
 
   [[nodiscard]] Prediction predict(const std::vector<float>& state) const;
   [[nodiscard]] std::vector<Prediction> predict_batch(const std::vector<std::vector<float>>& states) const;
 
-  LossStats train_batch(const std::vector<TrainingExample>& batch, float lr, float weight_decay);
+  // Variantes zero-copy: leen input_dim() floats por estado directamente del
+  // buffer del llamador (contiguo, n * input_dim()) y escriben n predicciones en out.
+  [[nodiscard]] Prediction predict(const float* state) const;
+  void predict_batch(const float* states, int64_t n, Prediction* out) const;
+
+  // weights (opcional, uno por ejemplo): pesos de importance sampling del
+  // replay priorizado. example_losses (opcional): loss de cada ejemplo
+  // (política + valor, sin pesar) para actualizar sus prioridades. Los
+  // ejemplos se decodifican en una pasada sobre un TrainBatch interno que se
+  // reusa entre llamadas.
+  LossStats train_batch(const std::vector<TrainingExample>& batch,
+                        float lr,
+                        float weight_decay,
+                        const float* weights = nullptr,
+                        float* example_losses = nullptr);
+
+  // Reserva un TrainBatch de `capacity` filas para este modelo.
+  [[nodiscard]] TrainBatch make_train_batch(int64_t capacity) const;
+  // Igual que train_batch sobre vectores, pero sin armar nada: en CPU entrena
+  // directo sobre el batch y en CUDA lo copia a tensores del device reusados
+  // (non_blocking si es pinned). Al volver la copia ya terminó, así que el
+  // llamador puede volver a llenar el batch.
+  LossStats train_batch(const TrainBatch& batch, float lr, float weight_decay, float* example_losses = nullptr);
 
   void copy_from(const PolicyValueModel& other);
   void reset_optimizer(float lr, float weight_decay);
@@ -94,9 +134,29 @@ class PolicyValueModel {
   torch::Device device_ = torch::kCPU;
   mutable AlphaSnakeNet net_{nullptr};
   std::unique_ptr<torch::optim::AdamW> optimizer_;
+  std::atomic<uint64_t> version_{0};
 
   mutable std::mutex train_mu_;
   mutable std::mutex infer_mu_;
+
+  // Batches reusados por train_batch (protegidos por train_mu_): host_batch_
+  // para decodificar vectores de ejemplos y device_batch_ como destino de la
+  // copia en CUDA. Crecen al capacity más grande visto.
+  TrainBatch host_batch_;
+  TrainBatch device_batch_;
+
+  [[nodiscard]] TrainBatch alloc_train_batch(int64_t capacity, const torch::TensorOptions& opts) const;
+  LossStats train_locked(const TrainBatch& batch, float lr, float weight_decay, float* example_losses);
+
+  // Forward, loss y paso del optimizador sobre tensores ya en el device
+  // (w indefinido = sin pesos). Requiere train_mu_ tomado.
+  LossStats optimize(const torch::Tensor& x,
+                     const torch::Tensor& y_p,
+                     const torch::Tensor& y_v,
+                     const torch::Tensor& w,
+                     float lr,
+                     float weight_decay,
+                     float* example_losses);
 };
 
 }  // namespace alphasnake
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "model/policy_value_model.hpp"
+
+namespace alphasnake {
+
+// Cache acotado de predicciones por posición, delante de predict/predict_batch.
+// La clave es (SnakeEnv::hash(), PolicyValueModel::weights_version()): al
+// cambiar los pesos las entradas viejas dejan de coincidir solas, sin barrer
+// la tabla, y como copy_from hereda la versión, best y candidate comparten
+// entradas cuando tienen los mismos pesos.
+//
+// Tabla de asignación directa partida en shards con su propio mutex (el shard
+// sale de los bits altos del hash, el slot de los bajos): una colisión pisa la
+// entrada anterior, así que la memoria queda fija en `capacity` entradas.
+class PredictionCache {
+ public:
+  struct Stats {
+    long long lookups = 0;
+    long long hits = 0;
+    long long stale = 0;  // clave presente pero de otra versión de pesos
+    long long stores = 0;
+
+    [[nodiscard]] double hit_rate() const {
+      return lookups > 0 ? static_cast<double>(hits) / static_cast<double>(lookups) : 0.0;
+    }
+  };
+
+  // capacity = 0 desactiva el cache (lookup siempre falla, store no hace nada).
+  explicit PredictionCache(std::size_t capacity) {
+    if (capacity == 0) {
+      return;
+    }
+    std::size_t per_shard = 1;
+    while (per_shard * kShards < capacity) {
+      per_shard <<= 1;
+    }
+    slot_mask_ = per_shard - 1;
+    shards_.reset(new Shard[kShards]);
+    for (std::size_t s = 0; s < kShards; ++s) {
+      shards_[s].slots.resize(per_shard);
+    }
+  }
+
+  [[nodiscard]] bool enabled() const { return shards_ != nullptr; }
+  [[nodiscard]] std::size_t capacity() const { return enabled() ? kShards * (slot_mask_ + 1) : 0; }
+
+  bool lookup(uint64_t hash, uint64_t version, Prediction& out) {
+    if (!enabled()) {
+      return false;
+    }
+    const uint64_t key = mix(hash, version);
+    Shard& sh = shard(key);
+    std::lock_guard<std::mutex> lock(sh.mu);
+    ++sh.lookups;
+    const Entry& e = sh.slots[static_cast<std::size_t>(key) & slot_mask_];
+    if (e.hash != hash || e.version == 0) {
+      return false;
+    }
+    if (e.version != version) {
+      ++sh.stale;
+      return false;
+    }
+    ++sh.hits;
+    out = e.pred;
+    return true;
+  }
+
+  void store(uint64_t hash, uint64_t version, const Prediction& pred) {
+    if (!enabled() || version == 0) {
+      return;
+    }
+    const uint64_t key = mix(hash, version);
+    Shard& sh = shard(key);
+    std::lock_guard<std::mutex> lock(sh.mu);
+    ++sh.stores;
+    Entry& e = sh.slots[static_cast<std::size_t>(key) & slot_mask_];
+    e.hash = hash;
+    e.version = version;
+    e.pred = pred;
+  }
+
+  void clear() {
+    for (std::size_t s = 0; enabled() && s < kShards; ++s) {
+      std::lock_guard<std::mutex> lock(shards_[s].mu);
+      std::fill(shards_[s].slots.begin(), shards_[s].slots.end(), Entry{});
+    }
+  }
+
+  [[nodiscard]] Stats stats() const {
+    Stats st;
+    for (std::size_t s = 0; enabled() && s < kShards; ++s) {
+      std::lock_guard<std::mutex> lock(shards_[s].mu);
+      st.lookups += shards_[s].lookups;
+      st.hits += shards_[s].hits;
+      st.stale += shards_[s].stale;
+      st.stores += shards_[s].stores;
+    }
+    return st;
+  }
+
+ private:
+  static constexpr std::size_t kShards = 64;
+  static constexpr int kShardShift = 58;  // 64 - log2(kShards)
+
+  struct Entry {
+    uint64_t hash = 0;
+    uint64_t version = 0;  // 0 = vacía
+    Prediction pred;
+  };
+
+  // Contadores por shard bajo su mutex: sin atómicos compartidos entre hilos.
+  struct alignas(64) Shard {
+    mutable std::mutex mu;
+    std::vector<Entry> slots;
+    long long lookups = 0;
+    long long hits = 0;
+    long long stale = 0;
+    long long stores = 0;
+  };
+
+  // La versión entra al índice: best y candidate no se pisan la misma posición.
+  static uint64_t mix(uint64_t hash, uint64_t version) {
+    return hash ^ (version * 0x9E3779B97F4A7C15ULL);
+  }
+
+  Shard& shard(uint64_t key) { return shards_[static_cast<std::size_t>(key >> kShardShift)]; }
+
+  std::unique_ptr<Shard[]> shards_;
+  std::size_t slot_mask_ = 0;
+};
+
+}  // namespace alphasnake
@@ -1,7 +1,11 @@
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <random>
+#include <vector>
 
 #include "env/snake_env.hpp"
+#include "env/snake_env_batch.hpp"
 
 using namespace alphasnake;
 
@@ -43,6 +47,211 @@ int main() {
     assert(st.size() == static_cast<std::size_t>(4 * 20 * 20));
   }
 
+  {
+    // encode_state sobre un buffer reusado (sucio) coincide con get_state.
+    SnakeEnv env(20, 2000, 5);
+    env.step(0);
+    env.step(2);
+    std::vector<float> buf(static_cast<std::size_t>(env.state_size()), 9.0f);
+    env.encode_state(buf.data());
+    assert(buf == env.get_state());
+  }
+
+  {
+    // decode_state(pack_state()) reproduce encode_state, también en tamaños
+    // sin especialización y sobre un buffer sucio.
+    std::mt19937 rng(4);
+    std::uniform_int_distribution<int> act(0, 3);
+    for (const int size : {7, 10, 20}) {
+      SnakeEnv env(size, 2000, 11);
+      std::vector<float> buf(static_cast<std::size_t>(env.state_size()), 9.0f);
+      for (int i = 0; i < 300; ++i) {
+        SnakeEnv::decode_state(size, env.pack_state(), buf.data());
+        assert(buf == env.get_state());
+        env.step(act(rng));
+        if (env.is_done()) {
+          env.reset(static_cast<uint32_t>(i));
+        }
+      }
+    }
+  }
+
+  {
+    // La copia es independiente del original (almacenamiento inline).
+    SnakeEnv env(20, 2000, 123);
+    SnakeEnv copy = env;
+    const auto h = env.head();
+    copy.step(0);  // UP
+    assert(env.head().x == h.x && env.head().y == h.y);
+    assert(copy.head().y == h.y - 1);
+    assert(env.snake_length() == copy.snake_length());
+  }
+
+  {
+    // Tableros de hasta kMaxBoardSize: recorrer la fila completa sin comer.
+    SnakeEnv env(kMaxBoardSize, 5000, 7);
+    const auto h = env.head();
+    env.set_food({0, 0});
+    StepResult st{};
+    int moves = 0;
+    while (!st.done) {
+      st = env.step(3);
+      ++moves;
+    }
+    assert(moves == kMaxBoardSize - h.x);
+    assert(env.snake_length() == 3);
+  }
+
+  {
+    // Índice de celdas libres consistente con el cuerpo tras juego aleatorio.
+    std::mt19937 rng(99);
+    std::uniform_int_distribution<int> act(0, 3);
+    for (uint32_t seed = 1; seed <= 20; ++seed) {
+      SnakeEnv env(10, 2000, seed);
+      while (!env.is_done()) {
+        env.step(act(rng));
+        const int n = env.board_size() * env.board_size();
+        assert(env.free_cell_count() + static_cast<int>(env.snake_length()) == n);
+        std::vector<uint8_t> seen(static_cast<std::size_t>(n), 0);
+        for (const auto& p : env.snake()) {
+          seen[static_cast<std::size_t>(p.y * env.board_size() + p.x)] = 1;
+        }
+        for (int i = 0; i < env.free_cell_count(); ++i) {
+          const Point p = env.free_cell(i);
+          auto& cell = seen[static_cast<std::size_t>(p.y * env.board_size() + p.x)];
+          assert(cell == 0);
+          cell = 1;
+        }
+      }
+    }
+  }
+
+  {
+    // safe_action_mask marca exactamente las jugadas que chocan en el próximo
+    // paso (choque = done sin mover la cabeza; inanición sí la mueve).
+    std::mt19937 rng(8);
+    std::uniform_int_distribution<int> act(0, 3);
+    for (uint32_t seed = 1; seed <= 30; ++seed) {
+      SnakeEnv env(6, 2000, seed);
+      while (!env.is_done()) {
+        const auto valid = env.valid_action_mask();
+        const auto safe = env.safe_action_mask();
+        for (int a = 0; a < 4; ++a) {
+          if (valid[static_cast<std::size_t>(a)] == 0) {
+            assert(safe[static_cast<std::size_t>(a)] == 0);
+            continue;
+          }
+          SnakeEnv next = env;
+          const StepResult r = next.step(a);
+          const bool crashed = r.done && !r.won && next.head().x == env.head().x &&
+                               next.head().y == env.head().y;
+          assert((safe[static_cast<std::size_t>(a)] == 0) == crashed);
+        }
+        env.step(act(rng));
+      }
+    }
+  }
+
+  {
+    // Hash Zobrist incremental == recalculado, y sigue a lo que codifica el estado.
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<int> act(0, 3);
+    for (const int board : {7, 10, 20}) {
+      SnakeEnv env(board, 2000, 3);
+      assert(env.hash() == env.full_hash());
+      for (int t = 0; t < 3000; ++t) {
+        const uint64_t before = env.hash();
+        const SnakeEnv copy = env;
+        env.step(act(rng));
+        assert(env.hash() == env.full_hash());
+        assert(copy.hash() == before);
+        if (t % 50 == 0 && !env.is_done() && env.free_cell_count() > 1) {
+          env.set_food(env.free_cell(0));
+          assert(env.hash() == env.full_hash());
+        }
+        if (env.is_done()) {
+          env.reset(static_cast<uint32_t>(t));
+          assert(env.hash() == env.full_hash());
+        }
+      }
+    }
+  }
+
+  {
+    // Las especializaciones 10/20 coinciden con el camino genérico (0).
+    for (const int board : {10, 20}) {
+      SnakeEnv fixed(board, 3000, 77);
+      SnakeEnv generic(board, 3000, 77);
+      std::mt19937 rng(11);
+      std::uniform_int_distribution<int> act(0, 3);
+      std::vector<float> a(static_cast<std::size_t>(fixed.state_size()));
+      std::vector<float> b(a.size());
+      for (int t = 0; t < 3000; ++t) {
+        const int action = act(rng);
+        const StepResult r1 = fixed.step(action);
+        const StepResult r2 = generic.step_fixed<0>(action);
+        assert(r1.reward == r2.reward && r1.done == r2.done);
+        fixed.encode_state(a.data());
+        generic.encode_state_fixed<0>(b.data());
+        assert(a == b);
+        if (fixed.is_done()) {
+          fixed.reset(static_cast<uint32_t>(t));
+          generic.reset(static_cast<uint32_t>(t));
+        }
+      }
+    }
+  }
+
+  {
+    // SnakeEnvBatch (SIMD y escalar) reproduce SnakeEnv paso a paso con las
+    // mismas seeds. N=13 ejercita el resto de los kernels de 8 y 4 carriles.
+    for (const bool simd : {true, false}) {
+      const int n = 13;
+      const uint32_t seed = 1000;
+      SnakeEnvBatch batch(n, 10, 300, seed);
+      batch.set_use_simd(simd);
+      std::vector<SnakeEnv> ref;
+      for (int i = 0; i < n; ++i) {
+        ref.emplace_back(10, 300, seed + static_cast<uint32_t>(i));
+      }
+
+      std::mt19937 rng(4321);
+      std::uniform_int_distribution<int> act(-1, 4);
+      std::vector<int> actions(static_cast<std::size_t>(n));
+      std::vector<StepResult> out(static_cast<std::size_t>(n));
+      std::vector<float> states(static_cast<std::size_t>(n * batch.state_size()));
+      uint32_t next_seed = 5000;
+
+      for (int t = 0; t < 2000; ++t) {
+        for (auto& a : actions) a = act(rng);
+        batch.step(actions.data(), out.data());
+        batch.get_state(states.data());
+        for (int i = 0; i < n; ++i) {
+          SnakeEnv& env = ref[static_cast<std::size_t>(i)];
+          const StepResult r = env.step(actions[static_cast<std::size_t>(i)]);
+          const StepResult& b = out[static_cast<std::size_t>(i)];
+          assert(r.reward == b.reward && r.done == b.done);
+          assert(r.food_eaten == b.food_eaten && r.won == b.won);
+          assert(env.is_done() == batch.is_done(i));
+          assert(env.head().x == batch.head(i).x && env.head().y == batch.head(i).y);
+          assert(env.food().x == batch.food(i).x && env.food().y == batch.food(i).y);
+          assert(env.snake_length() == batch.snake_length(i));
+          assert(env.direction() == batch.direction(i));
+
+          const auto st = env.get_state();
+          assert(std::equal(st.begin(), st.end(),
+                            states.begin() + static_cast<std::ptrdiff_t>(i * batch.state_size())));
+
+          if (env.is_done()) {
+            env.reset(next_seed);
+            batch.reset(i, next_seed);
+            ++next_seed;
+          }
+        }
+      }
+    }
+  }
+
   std::cout << "test_env: OK\n";
   return 0;
 }
@@ -0,0 +1,557 @@
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "common/config.hpp"
+#include "env/snake_env.hpp"
+#include "mcts/mcts.hpp"
+
+using namespace alphasnake;
+
+namespace {
+
+// Red falsa: política uniforme y valor 0, así el árbol depende solo del
+// MCTS (y de su rng) y no hace falta LibTorch.
+Prediction uniform_predict(const SnakeEnv&) { return Prediction{}; }
+
+std::vector<Prediction> uniform_predict_many(const std::vector<const SnakeEnv*>& envs) {
+  return std::vector<Prediction>(envs.size());
+}
+
+MCTS make_mcts(const TrainConfig& cfg, uint32_t seed) {
+  return MCTS(cfg, uniform_predict, uniform_predict_many, seed);
+}
+
+// Red falsa con prior concentrado en seguir derecho: el árbol se concentra
+// en la línea que después se juega, así el subárbol reusado crece entre
+// jugadas hasta forzar la poda de la arena.
+Prediction straight_predict(const SnakeEnv& env) {
+  Prediction p;
+  p.policy = {0.01f, 0.01f, 0.01f, 0.01f};
+  p.policy[static_cast<std::size_t>(env.direction())] = 0.97f;
+  return p;
+}
+
+std::vector<Prediction> straight_predict_many(const std::vector<const SnakeEnv*>& envs) {
+  std::vector<Prediction> out;
+  out.reserve(envs.size());
+  for (const SnakeEnv* env : envs) {
+    out.push_back(straight_predict(*env));
+  }
+  return out;
+}
+
+TrainConfig small_config(int board, int simulations) {
+  TrainConfig cfg;
+  cfg.board_size = board;
+  cfg.max_steps = 4 * board * board;
+  cfg.num_simulations = simulations;
+  return cfg;
+}
+
+int safe_count(const SnakeEnv& env) {
+  const std::array<uint8_t, 4> safe = env.safe_action_mask();
+  return std::accumulate(safe.begin(), safe.end(), 0);
+}
+
+int argmax(const std::array<float, 4>& pi) {
+  return static_cast<int>(std::max_element(pi.begin(), pi.end()) - pi.begin());
+}
+
+// Celda a la que llega la cabeza con `action`.
+Point next_head(const SnakeEnv& env, int action) {
+  SnakeEnv probe = env;
+  probe.step(action);
+  return probe.head();
+}
+
+bool is_free(const SnakeEnv& env, const Point& p) {
+  for (int i = 0; i < env.free_cell_count(); ++i) {
+    if (env.free_cell(i).x == p.x && env.free_cell(i).y == p.y) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Una celda libre distinta de `avoid` (y de la comida actual).
+Point other_free_cell(const SnakeEnv& env, const Point& avoid) {
+  for (int i = 0; i < env.free_cell_count(); ++i) {
+    const Point p = env.free_cell(i);
+    if ((p.x != avoid.x || p.y != avoid.y) && (p.x != env.food().x || p.y != env.food().y)) {
+      return p;
+    }
+  }
+  assert(false);
+  return avoid;
+}
+
+// Juega al azar entre las jugadas seguras y, con probabilidad grow, pone la
+// comida delante de la cabeza para que la serpiente crezca rápido. Deja en
+// out la primera posición (no terminal) que cumple pred; false si no aparece.
+template <typename Pred>
+bool find_position(int board, uint32_t seed, float grow, Pred&& pred, SnakeEnv& out) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> unif(0.0f, 1.0f);
+  SnakeEnv env(board, 4 * board * board, seed);
+  while (!env.is_done()) {
+    if (pred(env)) {
+      out = env;
+      return true;
+    }
+    const std::array<uint8_t, 4> safe = env.safe_action_mask();
+    std::vector<int> actions;
+    for (int a = 0; a < 4; ++a) {
+      if (safe[static_cast<std::size_t>(a)] != 0) {
+        actions.push_back(a);
+      }
+    }
+    if (actions.empty()) {
+      return false;
+    }
+    const int action = actions[static_cast<std::size_t>(rng() % actions.size())];
+    if (unif(rng) < grow) {
+      const Point target = next_head(env, action);
+      if (is_free(env, target)) {
+        env.set_food(target);
+      }
+    }
+    env.step(action);
+  }
+  return false;
+}
+
+// Posiciones de media partida en 10x10 con al menos dos jugadas seguras.
+std::vector<SnakeEnv> midgame_positions() {
+  std::vector<SnakeEnv> positions;
+  for (uint32_t seed = 1; seed <= 6; ++seed) {
+    SnakeEnv env(10, 400, seed);
+    const int steps = 8 * static_cast<int>(seed);
+    if (find_position(10, seed, 0.5f, [&](const SnakeEnv& e) { return e.steps() == steps && safe_count(e) >= 2; },
+                      env)) {
+      positions.push_back(env);
+    }
+  }
+  assert(positions.size() >= 4);
+  return positions;
+}
+
+// Corre la API reanudable (begin_search/collect_leaves/apply_evaluations/
+// finish_search) con la red uniforme.
+std::array<float, 4> search_resumable(MCTS& mcts, const SnakeEnv& env, bool noise, float temperature) {
+  mcts.begin_search(env, noise, temperature <= 1e-6f);
+  std::vector<const SnakeEnv*> batch;
+  while (true) {
+    batch.clear();
+    const int n = mcts.collect_leaves(batch);
+    if (n == 0) {
+      break;
+    }
+    assert(static_cast<int>(batch.size()) == n);
+    const std::vector<Prediction> preds = uniform_predict_many(batch);
+    mcts.apply_evaluations(preds.data());
+  }
+  return mcts.finish_search(temperature);
+}
+
+// search() y la API reanudable arman el mismo árbol: misma política,
+// simulaciones y jugada elegida, con hojas de a una o en batch, con y sin
+// transposiciones y con y sin ruido en la raíz.
+void check_resumable_matches(const TrainConfig& base, const std::vector<SnakeEnv>& positions) {
+  for (const bool transpositions : {false, true}) {
+    for (const int leaf_batch : {1, 8}) {
+      TrainConfig cfg = base;
+      cfg.transpositions = transpositions;
+      cfg.leaf_batch_size = leaf_batch;
+      cfg.reuse_tree = false;
+      for (std::size_t i = 0; i < positions.size(); ++i) {
+        const bool noise = i % 2 == 1;
+        const uint32_t seed = 100 + static_cast<uint32_t>(i);
+        MCTS serial = make_mcts(cfg, seed);
+        MCTS resumable = make_mcts(cfg, seed);
+        const std::array<float, 4> a = serial.search(positions[i], noise, 1.0f);
+        const std::array<float, 4> b = search_resumable(resumable, positions[i], noise, 1.0f);
+        assert(a == b);
+        assert(serial.last_simulations() == resumable.last_simulations());
+        assert(serial.last_nn_states() == resumable.last_nn_states());
+        assert(serial.selected_action() == resumable.selected_action());
+      }
+    }
+  }
+}
+
+void test_resumable_matches_search() {
+  TrainConfig cfg = small_config(10, 64);
+  cfg.food_samples = 1;
+  check_resumable_matches(cfg, midgame_positions());
+}
+
+// Nodos de azar (food_samples > 1): con la comida al lado de la cabeza la
+// búsqueda pasa por el nodo de azar de la comida nueva, y aun así las dos
+// APIs arman el mismo árbol, con y sin Gumbel.
+void test_chance_nodes() {
+  std::vector<SnakeEnv> positions = midgame_positions();
+  for (SnakeEnv& env : positions) {
+    const std::array<uint8_t, 4> safe = env.safe_action_mask();
+    for (int a = 0; a < 4; ++a) {
+      const Point target = next_head(env, a);
+      if (safe[static_cast<std::size_t>(a)] != 0 && is_free(env, target)) {
+        env.set_food(target);
+        break;
+      }
+    }
+  }
+  TrainConfig cfg = small_config(10, 64);
+  cfg.food_samples = 4;
+  for (const bool gumbel : {false, true}) {
+    cfg.gumbel = gumbel;
+    check_resumable_matches(cfg, positions);
+  }
+}
+
+// Gumbel en la raíz: misma equivalencia entre las dos APIs y, aun con muy
+// pocas simulaciones, la política mejorada es una distribución sobre las
+// jugadas legales y la jugada elegida es una de ellas.
+void test_gumbel_search() {
+  TrainConfig cfg = small_config(10, 64);
+  cfg.food_samples = 1;
+  cfg.gumbel = true;
+  const std::vector<SnakeEnv> positions = midgame_positions();
+  check_resumable_matches(cfg, positions);
+
+  for (const int sims : {2, 4, 16}) {
+    cfg.num_simulations = sims;
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+      const std::array<uint8_t, 4> safe = positions[i].safe_action_mask();
+      MCTS mcts = make_mcts(cfg, 20 + static_cast<uint32_t>(i));
+      const std::array<float, 4> pi = mcts.search(positions[i], false, 1.0f);
+      float sum = 0.0f;
+      for (std::size_t a = 0; a < 4; ++a) {
+        assert(pi[a] >= 0.0f);
+        if (safe[a] == 0) {
+          assert(pi[a] == 0.0f);
+        }
+        sum += pi[a];
+      }
+      assert(std::abs(sum - 1.0f) < 1e-4f);
+      assert(safe[static_cast<std::size_t>(mcts.selected_action())] != 0);
+      assert(mcts.last_simulations() <= sims);
+    }
+  }
+}
+
+// Poda de muerte inmediata: las jugadas que chocan no reciben visitas, así
+// que en la política solo les queda el piso numérico de las visitas.
+void test_unsafe_moves_pruned() {
+  TrainConfig cfg = small_config(10, 64);
+  for (const SnakeEnv& env : midgame_positions()) {
+    const std::array<uint8_t, 4> safe = env.safe_action_mask();
+    MCTS mcts = make_mcts(cfg, 4);
+    const std::array<float, 4> pi = mcts.search(env, true, 1.0f);
+    for (std::size_t a = 0; a < 4; ++a) {
+      if (safe[a] == 0) {
+        assert(pi[a] < 1e-6f);
+      }
+    }
+    assert(safe[static_cast<std::size_t>(mcts.selected_action())] != 0);
+  }
+}
+
+// Callejón sin salida: sin jugadas seguras la raíz queda demostrada como
+// derrota sin pedirle nada a la red, por las dos APIs.
+void test_dead_end_proof() {
+  SnakeEnv env(7, 200, 1);
+  bool found = false;
+  for (uint32_t seed = 1; seed <= 500 && !found; ++seed) {
+    found = find_position(7, seed, 0.9f, [](const SnakeEnv& e) { return safe_count(e) == 0; }, env);
+  }
+  assert(found);
+  TrainConfig cfg = small_config(7, 32);
+  for (const int leaf_batch : {1, 8}) {
+    cfg.leaf_batch_size = leaf_batch;
+    MCTS serial = make_mcts(cfg, 3);
+    serial.search(env, false, 1.0f);
+    assert(serial.root_proof() == -1);
+    assert(serial.last_nn_states() == 0);
+
+    MCTS resumable = make_mcts(cfg, 3);
+    search_resumable(resumable, env, false, 1.0f);
+    assert(resumable.root_proof() == -1);
+    assert(resumable.last_nn_states() == 0);
+  }
+}
+
+// Un paso antes del callejón: todas las jugadas seguras llevan a una posición
+// sin salida, así que el solver demuestra la derrota de la raíz y corta la
+// búsqueda antes de gastar todas las simulaciones.
+void test_doomed_proof() {
+  auto doomed = [](const SnakeEnv& e) {
+    if (safe_count(e) < 2) {
+      return false;
+    }
+    const std::array<uint8_t, 4> safe = e.safe_action_mask();
+    for (int a = 0; a < 4; ++a) {
+      if (safe[static_cast<std::size_t>(a)] == 0) {
+        continue;
+      }
+      SnakeEnv next = e;
+      next.step(a);
+      if (next.is_done() || safe_count(next) != 0) {
+        return false;
+      }
+    }
+    return true;
+  };
+  SnakeEnv env(7, 200, 1);
+  bool found = false;
+  for (uint32_t seed = 1; seed <= 2000 && !found; ++seed) {
+    found = find_position(7, seed, 0.9f, doomed, env);
+  }
+  assert(found);
+  TrainConfig cfg = small_config(7, 64);
+  cfg.food_samples = 1;
+  MCTS mcts = make_mcts(cfg, 5);
+  mcts.search(env, false, 1.0f);
+  assert(mcts.root_proof() == -1);
+  assert(mcts.last_simulations() < cfg.num_simulations);
+}
+
+// Una sola jugada segura: se juega sin buscar (política one-hot, ni
+// simulaciones ni estados de red), por las dos APIs.
+void test_forced_move() {
+  SnakeEnv env(10, 400, 1);
+  bool found = false;
+  for (uint32_t seed = 1; seed <= 200 && !found; ++seed) {
+    found = find_position(10, seed, 0.8f, [](const SnakeEnv& e) { return safe_count(e) == 1; }, env);
+  }
+  assert(found);
+  const std::array<uint8_t, 4> safe = env.safe_action_mask();
+  const int only = static_cast<int>(std::find(safe.begin(), safe.end(), 1) - safe.begin());
+
+  TrainConfig cfg = small_config(10, 64);
+  for (const int leaf_batch : {1, 8}) {
+    cfg.leaf_batch_size = leaf_batch;
+    MCTS serial = make_mcts(cfg, 7);
+    const std::array<float, 4> pi = serial.search(env, true, 1.0f);
+    assert(pi[static_cast<std::size_t>(only)] == 1.0f);
+    assert(serial.selected_action() == only);
+    assert(serial.last_simulations() == 0);
+    assert(serial.last_nn_states() == 0);
+
+    MCTS resumable = make_mcts(cfg, 7);
+    resumable.begin_search(env, true, false);
+    std::vector<const SnakeEnv*> batch;
+    assert(resumable.collect_leaves(batch) == 0);
+    assert(resumable.finish_search(1.0f) == pi);
+  }
+}
+
+// Presupuestos: set_simulation_limit corta en el tope pedido (acotado a
+// num_simulations) y search_nn_budget acota los estados de red, por las dos
+// APIs.
+void test_search_budgets() {
+  SnakeEnv env(10, 400, 11);
+  for (int i = 0; i < 3; ++i) {
+    env.step(3);
+  }
+  assert(safe_count(env) >= 2);
+
+  for (const int leaf_batch : {1, 8}) {
+    TrainConfig cfg = small_config(10, 64);
+    cfg.leaf_batch_size = leaf_batch;
+    cfg.reuse_tree = false;
+    MCTS serial = make_mcts(cfg, 9);
+    MCTS resumable = make_mcts(cfg, 9);
+    for (const int limit : {1, 13, 64, 1000, 0}) {
+      const int expected = limit > 0 ? std::min(limit, cfg.num_simulations) : cfg.num_simulations;
+      serial.set_simulation_limit(limit);
+      resumable.set_simulation_limit(limit);
+      serial.search(env, false, 1.0f);
+      search_resumable(resumable, env, false, 1.0f);
+      assert(serial.last_simulations() == expected);
+      assert(resumable.last_simulations() == expected);
+    }
+
+    cfg.search_nn_budget = 10;
+    MCTS budgeted = make_mcts(cfg, 9);
+    budgeted.search(env, false, 1.0f);
+    assert(budgeted.last_nn_states() <= cfg.search_nn_budget);
+    assert(budgeted.last_simulations() < cfg.num_simulations);
+    MCTS budgeted_resumable = make_mcts(cfg, 9);
+    search_resumable(budgeted_resumable, env, false, 1.0f);
+    assert(budgeted_resumable.last_nn_states() <= cfg.search_nn_budget);
+    assert(budgeted_resumable.last_simulations() < cfg.num_simulations);
+  }
+}
+
+// Paralelismo de hojas: con leaf_batch_size > 1 search() junta las hojas de
+// cada ronda en una sola llamada batch (a lo sumo leaf_batch_size estados).
+void test_leaf_batches() {
+  TrainConfig cfg = small_config(10, 64);
+  cfg.leaf_batch_size = 8;
+  cfg.reuse_tree = false;
+  int single_calls = 0;
+  int batch_calls = 0;
+  int batch_states = 0;
+  std::size_t largest = 0;
+  MCTS mcts(
+      cfg,
+      [&](const SnakeEnv& env) {
+        ++single_calls;
+        return uniform_predict(env);
+      },
+      [&](const std::vector<const SnakeEnv*>& envs) {
+        ++batch_calls;
+        batch_states += static_cast<int>(envs.size());
+        largest = std::max(largest, envs.size());
+        return uniform_predict_many(envs);
+      },
+      1);
+  const SnakeEnv env(10, 400, 6);
+  const std::array<float, 4> pi = mcts.search(env, false, 1.0f);
+  // Solo la raíz se expande de a uno, antes de la primera ronda.
+  assert(single_calls == 1);
+  assert(largest > 1 && largest <= 8);
+  assert(single_calls + batch_states == mcts.last_nn_states());
+  assert(mcts.last_simulations() == cfg.num_simulations);
+  // Rondas de varias hojas: bastante menos llamadas que simulaciones.
+  assert(batch_calls < cfg.num_simulations / 2);
+  const float total = pi[0] + pi[1] + pi[2] + pi[3];
+  assert(total > 0.999f && total < 1.001f);
+}
+
+// Reuso del árbol: tras search + step + advance, la búsqueda siguiente parte
+// del subárbol jugado si no comió o si la comida que salió coincide con la
+// del árbol; si no, parte de cero. Sin reuse_tree da lo mismo que una
+// búsqueda nueva.
+void test_tree_reuse() {
+  // food_samples = 1: el hijo del árbol da el mismo step (misma rng del
+  // entorno) que el juego real, así que comer deja la misma comida.
+  TrainConfig cfg = small_config(10, 64);
+  cfg.food_samples = 1;
+  cfg.reuse_tree = true;
+  const int action = 3;  // RIGHT, la dirección inicial
+
+  {
+    // Sin comer: la comida lejos de la cabeza.
+    SnakeEnv env(10, 400, 4);
+    env.set_food(other_free_cell(env, next_head(env, action)));
+    MCTS mcts = make_mcts(cfg, 1);
+    mcts.search(env, false, 1.0f);
+    assert(mcts.last_reused_visits() == 0);
+    assert(!env.step(action).food_eaten);
+    mcts.advance(action, env);
+    mcts.search(env, false, 1.0f);
+    assert(mcts.last_reused_visits() > 0);
+  }
+
+  for (const bool same_food : {true, false}) {
+    // Comiendo: la comida justo delante de la cabeza.
+    SnakeEnv env(10, 400, 4);
+    const Point target = next_head(env, action);
+    assert(is_free(env, target));
+    env.set_food(target);
+    MCTS mcts = make_mcts(cfg, 1);
+    mcts.search(env, false, 1.0f);
+    assert(env.step(action).food_eaten);
+    if (!same_food) {
+      env.set_food(other_free_cell(env, env.head()));
+    }
+    mcts.advance(action, env);
+    mcts.search(env, false, 1.0f);
+    assert((mcts.last_reused_visits() > 0) == same_food);
+  }
+
+  {
+    // reuse_tree = false: advance no hace nada y la búsqueda siguiente es
+    // igual a la de un MCTS nuevo con el mismo seed.
+    TrainConfig off = cfg;
+    off.reuse_tree = false;
+    SnakeEnv env(10, 400, 4);
+    MCTS mcts = make_mcts(off, 1);
+    mcts.search(env, false, 1.0f);
+    env.step(action);
+    mcts.advance(action, env);
+    mcts.reseed(5);
+    const std::array<float, 4> reused = mcts.search(env, false, 1.0f);
+    assert(mcts.last_reused_visits() == 0);
+    MCTS fresh = make_mcts(off, 5);
+    assert(fresh.search(env, false, 1.0f) == reused);
+  }
+}
+
+// Transposiciones: posiciones iguales por distintos órdenes de jugadas
+// comparten nodo, así que la misma búsqueda pide menos estados a la red.
+void test_transpositions_share_nodes() {
+  // Serpiente corta en el centro (recién empezada): muchos órdenes de
+  // giros llegan a la misma posición.
+  const SnakeEnv env(10, 400, 3);
+  TrainConfig cfg = small_config(10, 200);
+  cfg.food_samples = 1;
+  cfg.reuse_tree = false;
+  cfg.transpositions = false;
+  MCTS tree = make_mcts(cfg, 1);
+  tree.search(env, false, 1.0f);
+  cfg.transpositions = true;
+  MCTS dag = make_mcts(cfg, 1);
+  dag.search(env, false, 1.0f);
+  assert(tree.last_simulations() == dag.last_simulations());
+  assert(dag.last_nn_states() < tree.last_nn_states());
+}
+
+// Con transposiciones un nodo puede colgar de varios padres: al re-enraizar
+// (advance) y al podar la arena, todo lo que deja de ser alcanzable desde la
+// raíz tiene que volver a la lista libre.
+void test_transpositions_release_nodes() {
+  for (const int food_samples : {1, 4}) {
+    TrainConfig cfg = small_config(10, 48);
+    cfg.food_samples = food_samples;
+    cfg.transpositions = true;
+    cfg.reuse_tree = true;
+    MCTS mcts(cfg, straight_predict, straight_predict_many, 2);
+    SnakeEnv env(10, 400, 7);
+    int reused = 0;
+    std::size_t peak = 0;
+    for (int move = 0; move < 120 && !env.is_done(); ++move) {
+      const std::array<float, 4> pi = mcts.search(env, false, 1.0f);
+      assert(mcts.live_nodes() == mcts.reachable_nodes());
+      reused += mcts.last_reused_visits() > 0 ? 1 : 0;
+      peak = std::max(peak, mcts.live_nodes());
+      const int action = argmax(pi);
+      env.step(action);
+      mcts.advance(action, env);
+      assert(mcts.live_nodes() == mcts.reachable_nodes());
+    }
+    // El árbol se reusó y creció más allá de lo que se conserva al podar
+    // (2 búsquedas de nodos, el doble con nodos de azar), así que la poda
+    // corrió de verdad.
+    const std::size_t per_search = static_cast<std::size_t>((food_samples > 1 ? 2 : 1) * cfg.num_simulations + 1);
+    assert(reused > 0);
+    assert(peak > 2 * per_search);
+  }
+}
+
+}  // namespace
+
+int main() {
+  test_tree_reuse();
+  test_leaf_batches();
+  test_resumable_matches_search();
+  test_chance_nodes();
+  test_gumbel_search();
+  test_unsafe_moves_pruned();
+  test_dead_end_proof();
+  test_doomed_proof();
+  test_forced_move();
+  test_search_budgets();
+  test_transpositions_share_nodes();
+  test_transpositions_release_nodes();
+
+  std::cout << "test_mcts: OK\n";
+  return 0;
+}
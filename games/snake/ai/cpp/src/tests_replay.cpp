@@ -0,0 +1,126 @@
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "env/snake_env.hpp"
+#include "train/replay_buffer.hpp"
+
+using namespace alphasnake;
+
+namespace {
+
+// Un juego de n ejemplos; outcome = índice del ejemplo para reconocerlo al
+// muestrear.
+std::vector<TrainingExample> make_game(int board, std::size_t n) {
+  SnakeEnv env(board, 4 * board * board, 1);
+  std::vector<TrainingExample> game(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    game[i].state = env.pack_state();
+    game[i].policy = {0.25f, 0.25f, 0.25f, 0.25f};
+    game[i].outcome = static_cast<float>(i);
+  }
+  return game;
+}
+
+// Replay priorizado con alpha = beta = 1: 100 ejemplos, uno con prioridad 99
+// y el resto con 1. El grande tiene la mitad de la masa, así que sale en ~50%
+// de las muestras, y su peso IS normalizado es (100 * 0.5)^-1 / (100 / 198)^-1
+// = 1 / 99 ≈ 0.0101.
+void test_prioritized_sampling() {
+  constexpr std::size_t kItems = 100;
+  constexpr std::size_t kBig = 37;
+  ReplayBuffer buffer(kItems, 10, true, 1.0f, 1.0f, 1);
+  buffer.add_many(make_game(10, kItems));
+  assert(buffer.size() == kItems);
+
+  // Un solo shard: el slot de cada ejemplo es su orden de llegada. La
+  // prioridad es loss + 1e-3 con alpha = 1.
+  ReplayBuffer::SampleInfo all;
+  std::vector<float> losses(kItems, 1.0f - 1e-3f);
+  for (std::size_t i = 0; i < kItems; ++i) {
+    all.slots.push_back(i);
+  }
+  losses[kBig] = 99.0f - 1e-3f;
+  buffer.update_priorities(all, losses.data());
+
+  std::mt19937 rng(7);
+  ReplayBuffer::SampleInfo info;
+  std::size_t draws = 0;
+  std::size_t big = 0;
+  for (int round = 0; round < 50; ++round) {
+    const std::vector<TrainingExample> batch = buffer.sample(64, rng, &info);
+    assert(batch.size() == 64 && info.weights.size() == 64 && info.slots.size() == 64);
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      const std::size_t id = static_cast<std::size_t>(batch[i].outcome);
+      assert(info.slots[i] == id);
+      if (id == kBig) {
+        ++big;
+        assert(std::abs(info.weights[i] - 1.0f / 99.0f) < 1e-4f);
+      } else {
+        assert(std::abs(info.weights[i] - 1.0f) < 1e-4f);
+      }
+      ++draws;
+    }
+  }
+  const double share = static_cast<double>(big) / static_cast<double>(draws);
+  assert(std::abs(share - 0.5) < 0.02);
+}
+
+// Sin prioridades el muestreo es uniforme y todos los pesos valen 1.
+void test_uniform_sampling() {
+  constexpr std::size_t kItems = 100;
+  ReplayBuffer buffer(kItems, 10, false, 1.0f, 1.0f, 4);
+  for (int g = 0; g < 4; ++g) {
+    buffer.add_many(make_game(10, kItems / 4));
+  }
+  assert(buffer.size() == kItems);
+
+  std::mt19937 rng(3);
+  ReplayBuffer::SampleInfo info;
+  std::vector<std::size_t> hits(kItems / 4, 0);
+  for (int round = 0; round < 200; ++round) {
+    const std::vector<TrainingExample> batch = buffer.sample(50, rng, &info);
+    assert(batch.size() == 50);
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      assert(info.weights[i] == 1.0f);
+      ++hits[static_cast<std::size_t>(batch[i].outcome)];
+    }
+  }
+  // Cada índice aparece en 4 juegos: esperado 200 * 50 / 25 = 400.
+  for (const std::size_t h : hits) {
+    assert(h > 300 && h < 500);
+  }
+}
+
+// Un juego más largo que un shard se reparte entre shards en vez de pisarse
+// a sí mismo; uno más largo que todo el buffer deja sus últimos ejemplos.
+void test_long_game_fills_shards() {
+  {
+    ReplayBuffer buffer(100, 10, true, 1.0f, 1.0f, 4);
+    buffer.add_many(make_game(10, 100));
+    assert(buffer.size() == 100);
+  }
+  {
+    ReplayBuffer buffer(100, 10, false, 0.6f, 0.4f, 4);
+    buffer.add_many(make_game(10, 30));
+    buffer.add_many(make_game(10, 250));
+    assert(buffer.size() == 100);
+    std::mt19937 rng(11);
+    for (const TrainingExample& ex : buffer.sample(100, rng)) {
+      assert(ex.outcome >= 150.0f);
+    }
+  }
+}
+
+}  // namespace
+
+int main() {
+  test_prioritized_sampling();
+  test_uniform_sampling();
+  test_long_game_fills_shards();
+  std::cout << "test_replay: OK\n";
+  return 0;
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "model/policy_value_model.hpp"
+#include "train/replay_buffer.hpp"
+
+namespace alphasnake {
+
+// Arma los batches de entrenamiento en hilos aparte: cada loader muestrea del
+// replay buffer y decodifica directo en un TrainBatch reusado (pinned en
+// CUDA) mientras el paso actual hace forward/backward. Los slots rotan entre
+// una cola de libres y una de listos (doble/triple buffer), así que el
+// optimizador solo espera si los loaders van atrasados. Con loaders = 0 arma
+// el batch en el mismo hilo, al pedirlo.
+class BatchPrefetcher {
+ public:
+  struct Slot {
+    TrainBatch batch;
+    ReplayBuffer::SampleInfo info;
+  };
+
+  BatchPrefetcher(const ReplayBuffer& buffer,
+                  const PolicyValueModel& model,
+                  int batch_size,
+                  int slots,
+                  int loaders,
+                  uint32_t seed)
+      : buffer_(buffer),
+        batch_size_(static_cast<std::size_t>(std::max(1, batch_size))),
+        loaders_(std::max(0, loaders)),
+        slots_(static_cast<std::size_t>(std::max(1, slots))),
+        rng_(seed) {
+    for (Slot& slot : slots_) {
+      slot.batch = model.make_train_batch(static_cast<int64_t>(batch_size_));
+      slot.batch.weighted = buffer_.prioritized();
+      free_.push_back(&slot);
+    }
+  }
+
+  ~BatchPrefetcher() { stop(); }
+
+  BatchPrefetcher(const BatchPrefetcher&) = delete;
+  BatchPrefetcher& operator=(const BatchPrefetcher&) = delete;
+
+  void start() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (running_) {
+      return;
+    }
+    running_ = true;
+    std::seed_seq seq{rng_(), rng_()};
+    std::vector<uint32_t> seeds(static_cast<std::size_t>(loaders_));
+    seq.generate(seeds.begin(), seeds.end());
+    for (int i = 0; i < loaders_; ++i) {
+      workers_.emplace_back(&BatchPrefetcher::run_loader, this, seeds[static_cast<std::size_t>(i)]);
+    }
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (!running_) {
+        return;
+      }
+      running_ = false;
+    }
+    free_cv_.notify_all();
+    ready_cv_.notify_all();
+    for (auto& th : workers_) {
+      th.join();
+    }
+    workers_.clear();
+  }
+
+  // Próximo batch listo; bloquea si los loaders no llegaron. nullptr si se
+  // frenó el prefetcher. El slot vuelve a los loaders con release().
+  Slot* acquire() {
+    if (loaders_ == 0) {
+      Slot* slot = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (free_.empty()) {
+          return nullptr;
+        }
+        slot = free_.front();
+        free_.pop_front();
+      }
+      fill(*slot, rng_);
+      return slot;
+    }
+    std::unique_lock<std::mutex> lock(mu_);
+    ready_cv_.wait(lock, [&]() { return !ready_.empty() || !running_; });
+    if (ready_.empty()) {
+      return nullptr;
+    }
+    Slot* slot = ready_.front();
+    ready_.pop_front();
+    return slot;
+  }
+
+  void release(Slot* slot) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      free_.push_back(slot);
+    }
+    free_cv_.notify_one();
+  }
+
+ private:
+  void run_loader(uint32_t seed) {
+    std::mt19937 rng(seed);
+    for (;;) {
+      Slot* slot = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        free_cv_.wait(lock, [&]() { return !free_.empty() || !running_; });
+        if (!running_) {
+          return;
+        }
+        slot = free_.front();
+        free_.pop_front();
+      }
+      // Con el pipeline el buffer puede estar casi vacío al arrancar: solo
+      // se publican batches completos.
+      while (!fill(*slot, rng)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::lock_guard<std::mutex> lock(mu_);
+        if (!running_) {
+          free_.push_back(slot);
+          return;
+        }
+      }
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        ready_.push_back(slot);
+      }
+      ready_cv_.notify_one();
+    }
+  }
+
+  // Sin lock: el slot es de quien lo sacó de la cola y el buffer es seguro
+  // para muestrear desde varios hilos.
+  bool fill(Slot& slot, std::mt19937& rng) {
+    if (buffer_.size() < batch_size_) {
+      slot.batch.size = 0;
+      return false;
+    }
+    // El SampleInfo del slot se reusa: muestrear y decodificar no reserva memoria.
+    TrainBatch& b = slot.batch;
+    const std::size_t n = buffer_.sample_into(batch_size_, rng, b.states.data_ptr<float>(),
+                                              b.policies.data_ptr<float>(), b.outcomes.data_ptr<float>(),
+                                              &slot.info);
+    if (b.weighted) {
+      std::copy(slot.info.weights.begin(), slot.info.weights.end(), b.weights.data_ptr<float>());
+    }
+    b.size = static_cast<int64_t>(n);
+    return n == batch_size_;
+  }
+
+  const ReplayBuffer& buffer_;
+  const std::size_t batch_size_;
+  const int loaders_;
+  std::vector<Slot> slots_;
+  std::mt19937 rng_;
+
+  std::mutex mu_;
+  std::condition_variable free_cv_;
+  std::condition_variable ready_cv_;
+  std::deque<Slot*> free_;
+  std::deque<Slot*> ready_;
+  std::vector<std::thread> workers_;
+  bool running_ = false;
+};
+
+}  // namespace alphasnake
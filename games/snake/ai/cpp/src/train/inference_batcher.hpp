@@ -0,0 +1,495 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "env/snake_env.hpp"
+#include "model/policy_value_model.hpp"
+#include "model/prediction_cache.hpp"
+
+namespace alphasnake {
+
+// Controlador de batching: mide online la tasa de llegada de pedidos, la cola
+// ya esperando al arrancar cada batch y el tiempo de servicio por tamaño de
+// batch (ajuste lineal L(b) = a + c*b con olvido exponencial), y elige el
+// batch objetivo y el deadline de flush que maximizan el throughput con
+// latencia por pedido (llenado + servicio) <= cap. Contar la cola importa con
+// productores en lazo cerrado: ahí la tasa medida nunca supera el throughput
+// actual, pero los pedidos ya encolados no cuestan tiempo de llenado.
+class BatchTuner {
+ public:
+  BatchTuner(int max_batch, int max_wait_us, int latency_cap_us)
+      : max_batch_(max_batch),
+        max_wait_us_(max_wait_us),
+        latency_cap_us_(latency_cap_us),
+        target_batch_(max_batch),
+        wait_us_(max_wait_us) {}
+
+  // Un batch de n estados tardó model_us en servirse; al arrancarlo había
+  // `queued` pedidos esperando y en elapsed_us desde el batch anterior
+  // llegaron `arrivals` pedidos nuevos.
+  void observe(int n, double model_us, uint64_t queued, uint64_t arrivals, double elapsed_us) {
+    constexpr double kDecay = 0.98;
+    const double b = static_cast<double>(n);
+    s0_ = s0_ * kDecay + 1.0;
+    sb_ = sb_ * kDecay + b;
+    sbb_ = sbb_ * kDecay + b * b;
+    sl_ = sl_ * kDecay + model_us;
+    sbl_ = sbl_ * kDecay + b * model_us;
+
+    if (elapsed_us > 0.0) {
+      const double rate = static_cast<double>(arrivals) / elapsed_us;
+      rate_per_us_ = rate_per_us_ > 0.0 ? 0.8 * rate_per_us_ + 0.2 * rate : rate;
+    }
+    queued_ = 0.8 * queued_ + 0.2 * static_cast<double>(queued);
+    retune();
+  }
+
+  [[nodiscard]] int target_batch() const { return target_batch_; }
+  [[nodiscard]] int wait_us() const { return wait_us_; }
+  [[nodiscard]] double arrival_per_sec() const { return rate_per_us_ * 1e6; }
+  [[nodiscard]] double latency_us(int n) const {
+    double a = 0.0;
+    double c = 0.0;
+    fit(a, c);
+    return a + c * static_cast<double>(n);
+  }
+
+ private:
+  void fit(double& a, double& c) const {
+    if (s0_ <= 0.0) {
+      return;
+    }
+    const double mean_b = sb_ / s0_;
+    const double mean_l = sl_ / s0_;
+    const double var = sbb_ / s0_ - mean_b * mean_b;
+    if (var > 1e-6) {
+      c = std::max(0.0, (sbl_ / s0_ - mean_b * mean_l) / var);
+      a = std::max(0.0, mean_l - c * mean_b);
+    } else {
+      // Todos los batches del mismo tamaño: repartir mitad fija, mitad por estado.
+      a = 0.5 * mean_l;
+      c = mean_b > 0.0 ? 0.5 * mean_l / mean_b : 0.0;
+    }
+  }
+
+  // Tiempo esperado hasta juntar b pedidos, descontando los ya encolados.
+  [[nodiscard]] double fill_time_us(int b) const {
+    const double missing = std::max(0.0, static_cast<double>(b) - std::max(1.0, queued_));
+    return missing / rate_per_us_;
+  }
+
+  void retune() {
+    if (rate_per_us_ <= 0.0) {
+      return;
+    }
+    double a = 0.0;
+    double c = 0.0;
+    fit(a, c);
+
+    // Candidatos: potencias de dos hasta max_batch (y max_batch mismo).
+    int best_b = 1;
+    double best_thr = -1.0;
+    std::array<std::pair<int, double>, 32> cand{};
+    std::size_t nc = 0;
+    for (int b = 1;; b *= 2) {
+      const int bb = std::min(b, max_batch_);
+      const double fill_us = fill_time_us(bb);
+      const double model_us = a + c * static_cast<double>(bb);
+      if (fill_us + model_us <= static_cast<double>(latency_cap_us_) || bb == 1) {
+        const double thr = static_cast<double>(bb) / std::max({model_us, fill_us, 1e-3});
+        cand[nc++] = {bb, thr};
+        best_thr = std::max(best_thr, thr);
+      }
+      if (bb >= max_batch_ || nc == cand.size()) {
+        break;
+      }
+    }
+    // El menor batch con throughput a 5% del mejor: misma capacidad, menos latencia.
+    for (std::size_t i = 0; i < nc; ++i) {
+      if (cand[i].second >= 0.95 * best_thr) {
+        best_b = cand[i].first;
+        break;
+      }
+    }
+
+    target_batch_ = best_b;
+    const double fill_us = fill_time_us(best_b);
+    wait_us_ = static_cast<int>(std::clamp(1.2 * fill_us + 20.0, 20.0, static_cast<double>(max_wait_us_)));
+  }
+
+  int max_batch_;
+  int max_wait_us_;
+  int latency_cap_us_;
+  int target_batch_;
+  int wait_us_;
+  double rate_per_us_ = 0.0;
+  double queued_ = 0.0;
+  double s0_ = 0.0;
+  double sb_ = 0.0;
+  double sbb_ = 0.0;
+  double sl_ = 0.0;
+  double sbl_ = 0.0;
+};
+
+// Servidor de inferencia compartido por los hilos de self-play/eval: junta
+// hasta max_batch pedidos (o espera wait_us) y corre un solo predict_batch.
+//
+// Cola MPSC sin locks sobre un anillo de slots preasignados (secuencia por
+// slot al estilo Vyukov): el productor toma un ticket con fetch_add, publica
+// el entorno y espera la respuesta en el mismo slot con spin-then-park. El
+// mutex/condvar de cada slot solo se usa si el productor llegó a dormirse, así
+// que en régimen caliente no hay syscalls ni asignaciones por pedido.
+//
+// Con latency_cap_us > 0 el batch objetivo y el deadline se ajustan solos
+// (BatchTuner); max_batch y wait_us pasan a ser topes. Con 0 son fijos.
+//
+// Con un PredictionCache los productores resuelven los aciertos sin encolar
+// y el worker guarda cada predicción nueva al terminar el batch.
+class InferenceBatcher {
+ public:
+  struct Stats {
+    long long requests = 0;
+    long long states = 0;  // los que llegaron al modelo (sin aciertos del cache)
+    long long batches = 0;
+    // Valores elegidos por el controlador (o los fijos si no es adaptativo).
+    int target_batch = 0;
+    int wait_us = 0;
+    double arrival_per_sec = 0.0;
+    double batch_latency_us = 0.0;  // servicio estimado de un batch del target
+  };
+
+  InferenceBatcher(const PolicyValueModel& model,
+                   int max_batch,
+                   int wait_us,
+                   int latency_cap_us = 0,
+                   PredictionCache* cache = nullptr)
+      : model_(model),
+        cache_(cache != nullptr && cache->enabled() ? cache : nullptr),
+        max_batch_(std::max(1, max_batch)),
+        wait_us_(std::max(1, wait_us)),
+        // Con un solo core girar solo le roba tiempo al hilo que tiene que
+        // producir la respuesta: ahí se pasa directo a yield/park.
+        spin_iters_(std::thread::hardware_concurrency() > 1 ? kSpinIters : 0),
+        adaptive_(latency_cap_us > 0),
+        tuner_(max_batch_, wait_us_, latency_cap_us),
+        target_batch_(max_batch_),
+        cur_wait_us_(wait_us_),
+        capacity_(ring_capacity(max_batch_)),
+        mask_(capacity_ - 1),
+        cells_(new Cell[capacity_]),
+        staging_(static_cast<std::size_t>(max_batch_) * static_cast<std::size_t>(model.input_dim())),
+        preds_(static_cast<std::size_t>(max_batch_)),
+        batch_cells_(static_cast<std::size_t>(max_batch_)) {
+    for (uint64_t i = 0; i < capacity_; ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~InferenceBatcher() { stop(); }
+
+  void start() {
+    bool expected = false;
+    if (!running_.compare_exchange_strong(expected, true)) {
+      return;
+    }
+    worker_ = std::thread(&InferenceBatcher::run_loop, this);
+  }
+
+  void stop() {
+    bool expected = true;
+    if (!running_.compare_exchange_strong(expected, false)) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(worker_mu_);
+      worker_cv_.notify_all();
+    }
+    if (worker_.joinable()) {
+      worker_.join();
+    }
+  }
+
+  // El llamador bloquea hasta tener la predicción, así que el entorno sigue
+  // vivo mientras el worker lo codifica directo en el tensor de batch.
+  Prediction predict(const SnakeEnv& env) {
+    stats_requests_.fetch_add(1, std::memory_order_relaxed);
+    Prediction cached;
+    if (cache_ != nullptr && cache_->lookup(env.hash(), model_.weights_version(), cached)) {
+      return cached;
+    }
+    const uint64_t t = tail_.fetch_add(1);
+    publish(t, &env);
+    stats_states_.fetch_add(1, std::memory_order_relaxed);
+    return take_result(t);
+  }
+
+  // Enviar múltiples estados de golpe al batcher. Los tickets son contiguos,
+  // así que caen en el mismo batch GPU salvo que crucen un corte de batch
+  // (usado por food stochasticity y por el MCTS con hojas en batch).
+  std::vector<Prediction> predict_many(const std::vector<const SnakeEnv*>& envs) {
+    std::vector<Prediction> results(envs.size());
+    stats_requests_.fetch_add(static_cast<long long>(envs.size()), std::memory_order_relaxed);
+
+    // Solo se encolan los que no estaban en el cache (índices en `misses`).
+    std::vector<std::size_t> misses;
+    misses.reserve(envs.size());
+    const uint64_t version = cache_ != nullptr ? model_.weights_version() : 0;
+    for (std::size_t i = 0; i < envs.size(); ++i) {
+      if (cache_ == nullptr || !cache_->lookup(envs[i]->hash(), version, results[i])) {
+        misses.push_back(i);
+      }
+    }
+
+    // Nunca pedir más de medio anillo de una vez: el productor no libera sus
+    // slots hasta leer todas las respuestas.
+    const std::size_t chunk = static_cast<std::size_t>(capacity_ / 2);
+    for (std::size_t begin = 0; begin < misses.size(); begin += chunk) {
+      const std::size_t n = std::min(chunk, misses.size() - begin);
+      const uint64_t t = tail_.fetch_add(n);
+      for (std::size_t i = 0; i < n; ++i) {
+        publish(t + i, envs[misses[begin + i]]);
+      }
+      stats_states_.fetch_add(static_cast<long long>(n), std::memory_order_relaxed);
+      for (std::size_t i = 0; i < n; ++i) {
+        results[misses[begin + i]] = take_result(t + i);
+      }
+    }
+    return results;
+  }
+
+  [[nodiscard]] Stats stats() const {
+    Stats s;
+    s.requests = stats_requests_.load();
+    s.states = stats_states_.load();
+    s.batches = stats_batches_.load();
+    s.target_batch = target_batch_.load(std::memory_order_relaxed);
+    s.wait_us = cur_wait_us_.load(std::memory_order_relaxed);
+    s.arrival_per_sec = arrival_per_sec_.load(std::memory_order_relaxed);
+    s.batch_latency_us = batch_latency_us_.load(std::memory_order_relaxed);
+    return s;
+  }
+
+ private:
+  // Ciclo de vida del slot del ticket t (en la vuelta t / capacity):
+  //   seq == t      libre, el productor escribe env
+  //   seq == t + 1  publicado, el worker lo puede tomar
+  //   done == 1     respuesta escrita en result
+  //   seq == t + capacity  el productor leyó la respuesta; libre para la próxima vuelta
+  struct alignas(64) Cell {
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint32_t> done{0};
+    std::atomic<bool> parked{false};
+    const SnakeEnv* env = nullptr;
+    Prediction result;
+    std::mutex mu;
+    std::condition_variable cv;
+  };
+
+  static constexpr int kSpinIters = 2000;
+  static constexpr int kYieldIters = 50;
+
+  static uint64_t ring_capacity(int max_batch) {
+    uint64_t cap = 4096;
+    while (cap < static_cast<uint64_t>(max_batch) * 4) {
+      cap <<= 1;
+    }
+    return cap;
+  }
+
+  static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+  }
+
+  Cell& cell(uint64_t t) { return cells_[t & mask_]; }
+
+  void publish(uint64_t t, const SnakeEnv* env) {
+    Cell& c = cell(t);
+    // Anillo lleno (el slot de la vuelta anterior sigue en uso): esperar.
+    while (c.seq.load(std::memory_order_acquire) != t) {
+      std::this_thread::yield();
+    }
+    c.env = env;
+    c.done.store(0, std::memory_order_relaxed);
+    c.seq.store(t + 1);  // seq_cst: pareado con worker_parked_ (ver wait_for_work)
+    if (worker_parked_.load()) {
+      std::lock_guard<std::mutex> lock(worker_mu_);
+      worker_cv_.notify_one();
+    }
+  }
+
+  Prediction take_result(uint64_t t) {
+    Cell& c = cell(t);
+    bool ready = false;
+    for (int i = 0; i < spin_iters_ && !ready; ++i) {
+      ready = c.done.load(std::memory_order_acquire) != 0;
+      if (!ready) {
+        cpu_relax();
+      }
+    }
+    for (int i = 0; i < kYieldIters && !ready; ++i) {
+      std::this_thread::yield();
+      ready = c.done.load(std::memory_order_acquire) != 0;
+    }
+    if (!ready) {
+      std::unique_lock<std::mutex> lock(c.mu);
+      c.parked.store(true);
+      c.cv.wait(lock, [&]() { return c.done.load() != 0; });
+      c.parked.store(false);
+    }
+    const Prediction out = c.result;
+    c.seq.store(t + capacity_, std::memory_order_release);
+    return out;
+  }
+
+  [[nodiscard]] bool available(uint64_t r) const {
+    return cells_[r & mask_].seq.load() == r + 1;
+  }
+
+  // Espera (spin-then-park) a que el ticket r esté publicado. Devuelve false
+  // si el servidor se detuvo sin trabajo pendiente.
+  bool wait_for_work(uint64_t r) {
+    for (int i = 0; i < spin_iters_; ++i) {
+      if (available(r)) {
+        return true;
+      }
+      cpu_relax();
+    }
+    std::unique_lock<std::mutex> lock(worker_mu_);
+    worker_parked_.store(true);
+    worker_cv_.wait(lock, [&]() { return available(r) || !running_.load(); });
+    worker_parked_.store(false);
+    return available(r);
+  }
+
+  void complete(Cell& c, const Prediction& pred) {
+    c.result = pred;
+    c.done.store(1);  // seq_cst: pareado con c.parked en take_result
+    if (c.parked.load()) {
+      std::lock_guard<std::mutex> lock(c.mu);
+      c.cv.notify_one();
+    }
+  }
+
+  void run_loop() {
+    uint64_t r = 0;
+    const std::size_t dim = static_cast<std::size_t>(model_.input_dim());
+    auto last_batch = std::chrono::steady_clock::now();
+    uint64_t last_tail = 0;
+    while (wait_for_work(r)) {
+      const uint64_t queued = tail_.load(std::memory_order_relaxed) - r;
+      // Juntar tickets consecutivos hasta el batch objetivo o el deadline.
+      const int target = target_batch_.load(std::memory_order_relaxed);
+      const auto deadline = std::chrono::steady_clock::now() +
+                            std::chrono::microseconds(cur_wait_us_.load(std::memory_order_relaxed));
+      std::size_t n = 0;
+      while (n < static_cast<std::size_t>(target)) {
+        if (available(r + n)) {
+          batch_cells_[n] = &cell(r + n);
+          ++n;
+          continue;
+        }
+        if (!running_.load() || std::chrono::steady_clock::now() >= deadline) {
+          break;
+        }
+        std::this_thread::yield();
+      }
+
+      // Una sola escritura por hoja: cada entorno se codifica directo en su
+      // slot del buffer de staging que consume predict_batch.
+      const auto t_service = std::chrono::steady_clock::now();
+      bool shapes_ok = true;
+      for (std::size_t i = 0; i < n; ++i) {
+        shapes_ok = shapes_ok && batch_cells_[i]->env->state_size() == model_.input_dim();
+      }
+      if (shapes_ok) {
+        dispatch_board_size(model_.board_size(), [&](auto b) {
+          for (std::size_t i = 0; i < n; ++i) {
+            batch_cells_[i]->env->encode_state_fixed<decltype(b)::value>(staging_.data() + i * dim);
+          }
+        });
+      }
+
+      std::fill(preds_.begin(), preds_.begin() + static_cast<std::ptrdiff_t>(n), Prediction{});
+      if (shapes_ok) {
+        const uint64_t version = model_.weights_version();
+        model_.predict_batch(staging_.data(), static_cast<int64_t>(n), preds_.data());
+        for (std::size_t i = 0; cache_ != nullptr && i < n; ++i) {
+          cache_->store(batch_cells_[i]->env->hash(), version, preds_[i]);
+        }
+      }
+
+      for (std::size_t i = 0; i < n; ++i) {
+        complete(*batch_cells_[i], preds_[i]);
+      }
+      r += n;
+      stats_batches_.fetch_add(1, std::memory_order_relaxed);
+
+      if (adaptive_) {
+        // Tiempo de servicio completo del batch (codificar + modelo + avisar).
+        using us = std::chrono::duration<double, std::micro>;
+        const auto t_done = std::chrono::steady_clock::now();
+        const uint64_t tail = tail_.load(std::memory_order_relaxed);
+        tuner_.observe(static_cast<int>(n), us(t_done - t_service).count(), queued, tail - last_tail,
+                       us(t_done - last_batch).count());
+        last_tail = tail;
+        last_batch = t_done;
+        target_batch_.store(tuner_.target_batch(), std::memory_order_relaxed);
+        cur_wait_us_.store(tuner_.wait_us(), std::memory_order_relaxed);
+        arrival_per_sec_.store(tuner_.arrival_per_sec(), std::memory_order_relaxed);
+        batch_latency_us_.store(tuner_.latency_us(tuner_.target_batch()), std::memory_order_relaxed);
+      }
+    }
+  }
+
+  const PolicyValueModel& model_;
+  PredictionCache* const cache_;
+  int max_batch_ = 256;
+  int wait_us_ = 1000;
+  const int spin_iters_;
+
+  // El tuner solo lo toca el worker; los valores elegidos se publican en
+  // atómicos para run_loop y stats().
+  const bool adaptive_;
+  BatchTuner tuner_;
+  std::atomic<int> target_batch_;
+  std::atomic<int> cur_wait_us_;
+  std::atomic<double> arrival_per_sec_{0.0};
+  std::atomic<double> batch_latency_us_{0.0};
+
+  const uint64_t capacity_;
+  const uint64_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+  alignas(64) std::atomic<uint64_t> tail_{0};
+
+  // Solo el worker toca estos buffers: tensor de entrada [max_batch, 4, N, N],
+  // predicciones y slots del batch en curso, reservados una vez.
+  std::vector<float> staging_;
+  std::vector<Prediction> preds_;
+  std::vector<Cell*> batch_cells_;
+
+  std::mutex worker_mu_;
+  std::condition_variable worker_cv_;
+  std::atomic<bool> worker_parked_{false};
+
+  std::atomic<bool> running_{false};
+  std::thread worker_;
+
+  std::atomic<long long> stats_requests_{0};
+  std::atomic<long long> stats_states_{0};
+  std::atomic<long long> stats_batches_{0};
+};
+
+}  // namespace alphasnake
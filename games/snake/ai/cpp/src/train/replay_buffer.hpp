@@ -1,58 +1,367 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <random>
 #include <vector>
 
+#include "env/snake_env.hpp"
 #include "train/types.hpp"
 
 namespace alphasnake {
 
+// Ring buffer de ejemplos empaquetados en un slab contiguo: por ejemplo solo
+// las ceil(N² / 64) palabras del bitboard que usa el tablero más un registro
+// chico (cabeza, comida, dirección, objetivos). En 20x20 son ~84 B contra los
+// 6.4 KB del estado en floats; se decodifica recién al muestrear.
+//
+// Dividido en shards con lock propio: cada add_many (un juego terminado) va
+// entero a un shard por turno, así los workers de self-play escriben en
+// paralelo y el learner muestrea tomando cada shard solo mientras copia sus
+// ejemplos. Cada shard es un ring de capacity / shards con su propio desalojo;
+// un juego más largo que un shard se parte en tramos de esa capacidad que van
+// a shards sucesivos, para no pisarse a sí mismo.
+//
+// Con prioridades (prioritized experience replay) cada slot se muestrea con
+// probabilidad p_i^alpha / sum p^alpha vía un sum-tree por shard, con p_i la
+// última loss del ejemplo; los nuevos entran con la prioridad máxima vista en
+// su shard. Sin prioridades el muestreo es uniforme.
 class ReplayBuffer {
  public:
-  explicit ReplayBuffer(std::size_t capacity) : capacity_(capacity) {
-    data_.reserve(capacity_);
+  // Datos de un muestreo para devolver prioridades: slot de cada ejemplo y
+  // peso de importance sampling (w_i = (N * P(i))^-beta / max w, 1 si es uniforme).
+  // Reusar el mismo SampleInfo entre muestreos evita toda reserva de memoria:
+  // también guarda el scratch del sorteo.
+  struct SampleInfo {
+    std::vector<std::size_t> slots;
+    std::vector<float> weights;
+
+    // Sorteo (shard, clave): posición dentro del shard o, con prioridades,
+    // masa acumulada dentro del shard.
+    struct Draw {
+      std::size_t shard;
+      double key;
+    };
+    std::vector<std::size_t> shard_sizes;
+    std::vector<double> shard_masses;
+    std::vector<Draw> draws;
+  };
+
+  ReplayBuffer(std::size_t capacity,
+               int board_size,
+               bool prioritized = false,
+               float alpha = 0.6f,
+               float beta = 0.4f,
+               int shards = 1)
+      : board_size_(board_size),
+        words_(static_cast<std::size_t>((board_size * board_size + 63) / 64)),
+        prioritized_(prioritized),
+        alpha_(alpha),
+        beta_(beta) {
+    const std::size_t count = std::max<std::size_t>(
+        1, std::min(static_cast<std::size_t>(std::max(1, shards)), capacity));
+    shard_capacity_ = std::max<std::size_t>(1, (capacity + count - 1) / count);
+    shards_.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      auto shard = std::make_unique<Shard>();
+      shard->bits.reserve(shard_capacity_ * words_);
+      shard->records.reserve(shard_capacity_);
+      if (prioritized_) {
+        shard->tree.init(shard_capacity_);
+      }
+      shards_.push_back(std::move(shard));
+    }
   }
 
+  [[nodiscard]] bool prioritized() const { return prioritized_; }
+  [[nodiscard]] std::size_t shard_count() const { return shards_.size(); }
+
+  // Seguro desde varios hilos: los ejemplos van juntos a un shard (o en
+  // tramos de shard_capacity a shards sucesivos si no entran en uno) y solo
+  // bloquean a quien use ese mismo shard.
   void add_many(const std::vector<TrainingExample>& examples) {
-    std::lock_guard<std::mutex> lock(mu_);
-    for (const auto& ex : examples) {
-      if (data_.size() < capacity_) {
-        data_.push_back(ex);
-      } else {
-        data_[head_] = ex;
-        head_ = (head_ + 1) % capacity_;
+    // Más ejemplos que todo el buffer: los primeros se desalojarían igual.
+    const std::size_t total = shard_capacity_ * shards_.size();
+    std::size_t first = examples.size() > total ? examples.size() - total : 0;
+    while (first < examples.size()) {
+      const std::size_t last = std::min(examples.size(), first + shard_capacity_);
+      Shard& sh = *shards_[next_shard_.fetch_add(1, std::memory_order_relaxed) % shards_.size()];
+      add_range(sh, examples, first, last);
+      first = last;
+    }
+  }
+
+  // Nuevas prioridades a partir de la loss por ejemplo de train_batch, en el
+  // orden de info.slots. Si un slot fue sobrescrito entre el muestreo y esta
+  // llamada, la prioridad queda para el ejemplo nuevo (se corrige en su
+  // próxima muestra).
+  void update_priorities(const SampleInfo& info, const float* losses) {
+    if (!prioritized_) {
+      return;
+    }
+    // Los slots de un muestreo salen agrupados por shard: un lock por tramo.
+    std::size_t i = 0;
+    while (i < info.slots.size()) {
+      const std::size_t s = info.slots[i] / shard_capacity_;
+      Shard& sh = *shards_[s];
+      std::lock_guard<std::mutex> lock(sh.mu);
+      for (; i < info.slots.size() && info.slots[i] / shard_capacity_ == s; ++i) {
+        const double p = std::pow(static_cast<double>(std::max(0.0f, losses[i])) + kPriorityEps, alpha_);
+        sh.max_priority = std::max(sh.max_priority, p);
+        sh.tree.set(info.slots[i] % shard_capacity_, p);
       }
     }
   }
 
   [[nodiscard]] std::size_t size() const {
-    std::lock_guard<std::mutex> lock(mu_);
-    return data_.size();
+    std::size_t n = 0;
+    for (const auto& sh : shards_) {
+      std::lock_guard<std::mutex> lock(sh->mu);
+      n += sh->records.size();
+    }
+    return n;
   }
 
-  std::vector<TrainingExample> sample(std::size_t n, std::mt19937& rng) const {
-    std::lock_guard<std::mutex> lock(mu_);
-    std::vector<TrainingExample> out;
-    if (data_.empty()) {
-      return out;
-    }
-    n = std::min(n, data_.size());
-    out.reserve(n);
+  // Bytes ocupados por los ejemplos guardados (sin contar la reserva).
+  [[nodiscard]] std::size_t memory_bytes() const {
+    return size() * (words_ * sizeof(uint64_t) + sizeof(Record));
+  }
 
-    std::uniform_int_distribution<std::size_t> dist(0, data_.size() - 1);
-    for (std::size_t i = 0; i < n; ++i) {
-      out.push_back(data_[dist(rng)]);
-    }
+  std::vector<TrainingExample> sample(std::size_t n, std::mt19937& rng, SampleInfo* info = nullptr) const {
+    std::vector<TrainingExample> out(n);
+    const std::size_t got = draw(n, rng, info, [&](std::size_t i, const Shard& sh, std::size_t slot) {
+      const Record& r = sh.records[slot];
+      TrainingExample& ex = out[i];
+      std::copy_n(sh.bits.begin() + static_cast<std::ptrdiff_t>(slot * words_), words_, ex.state.occupancy.begin());
+      ex.state.head = r.head;
+      ex.state.food = r.food;
+      ex.state.direction = r.direction;
+      ex.policy = r.policy;
+      ex.outcome = r.outcome;
+    });
+    out.resize(got);
     return out;
   }
 
+  // Muestra n ejemplos decodificándolos directo en los buffers del batch:
+  // states (n * 4 * N² floats, layout de SnakeEnv::encode_state), policies
+  // (n * 4) y outcomes (n). Devuelve cuántos escribió (menos que n si el
+  // buffer tiene menos ejemplos).
+  std::size_t sample_into(std::size_t n,
+                          std::mt19937& rng,
+                          float* states,
+                          float* policies,
+                          float* outcomes,
+                          SampleInfo* info = nullptr) const {
+    const std::size_t dim = static_cast<std::size_t>(4 * board_size_ * board_size_);
+    return draw(n, rng, info, [&](std::size_t i, const Shard& sh, std::size_t slot) {
+      const Record& r = sh.records[slot];
+      SnakeEnv::decode_state(board_size_, sh.bits.data() + slot * words_, r.head, r.food, r.direction,
+                             states + i * dim);
+      std::copy(r.policy.begin(), r.policy.end(), policies + i * 4);
+      outcomes[i] = r.outcome;
+    });
+  }
+
  private:
-  std::size_t capacity_ = 0;
-  mutable std::mutex mu_;
-  std::vector<TrainingExample> data_;
-  std::size_t head_ = 0;
+  // Sum-tree: árbol binario completo en un arreglo (hojas en [cap, 2 cap)),
+  // cada nodo interno guarda la suma de sus hijos. set y find son O(log n).
+  class SumTree {
+   public:
+    void init(std::size_t n) {
+      cap_ = 1;
+      while (cap_ < n) {
+        cap_ <<= 1;
+      }
+      sums_.assign(2 * cap_, 0.0);
+    }
+    void set(std::size_t i, double p) {
+      std::size_t k = cap_ + i;
+      const double delta = p - sums_[k];
+      for (; k > 0; k >>= 1) {
+        sums_[k] += delta;
+      }
+    }
+    [[nodiscard]] double get(std::size_t i) const { return sums_[cap_ + i]; }
+    [[nodiscard]] double total() const { return sums_[1]; }
+    // Hoja donde cae la masa acumulada u (0 <= u < total()).
+    [[nodiscard]] std::size_t find(double u) const {
+      std::size_t k = 1;
+      while (k < cap_) {
+        k <<= 1;
+        if (u >= sums_[k]) {
+          u -= sums_[k];
+          ++k;
+        }
+      }
+      return k - cap_;
+    }
+
+   private:
+    std::size_t cap_ = 1;
+    std::vector<double> sums_;
+  };
+
+  static constexpr double kPriorityEps = 1e-3;
+
+  // Sortea n ejemplos sobre todos los shards y llama visit(i, shard, slot)
+  // con el lock de ese shard tomado. Primero fija una foto de tamaños (y masas
+  // de prioridad) por shard y reparte los sorteos; después visita shard por
+  // shard, así cada lock se toma una vez y solo mientras se copia. Los shards
+  // solo crecen o reemplazan en el lugar, así que un sorteo sobre la foto
+  // sigue cayendo en un slot válido. Devuelve cuántos escribió.
+  template <typename Visit>
+  std::size_t draw(std::size_t n, std::mt19937& rng, SampleInfo* info, Visit&& visit) const {
+    SampleInfo local;
+    SampleInfo& out = info != nullptr ? *info : local;
+    const std::size_t count = shards_.size();
+    std::vector<std::size_t>& sizes = out.shard_sizes;
+    std::vector<double>& masses = out.shard_masses;
+    sizes.assign(count, 0);
+    masses.assign(count, 0.0);
+    std::size_t total_size = 0;
+    double total_mass = 0.0;
+    for (std::size_t s = 0; s < count; ++s) {
+      std::lock_guard<std::mutex> lock(shards_[s]->mu);
+      sizes[s] = shards_[s]->records.size();
+      masses[s] = prioritized_ ? shards_[s]->tree.total() : 0.0;
+      total_size += sizes[s];
+      total_mass += masses[s];
+    }
+    out.slots.clear();
+    out.weights.clear();
+    if (total_size == 0) {
+      return 0;
+    }
+    n = std::min(n, total_size);
+    const bool weighted = prioritized_ && total_mass > 0.0;
+
+    // Con prioridades, muestreo estratificado: una muestra por tramo de igual masa.
+    using Draw = SampleInfo::Draw;
+    std::vector<Draw>& draws = out.draws;
+    draws.resize(n);
+    if (weighted) {
+      const double segment = total_mass / static_cast<double>(n);
+      std::uniform_real_distribution<double> unif(0.0, segment);
+      for (std::size_t i = 0; i < n; ++i) {
+        double u = std::min(segment * static_cast<double>(i) + unif(rng), std::nextafter(total_mass, 0.0));
+        std::size_t s = 0;
+        while (s + 1 < count && (u >= masses[s] || sizes[s] == 0)) {
+          u -= masses[s];
+          ++s;
+        }
+        draws[i] = {s, std::max(0.0, u)};
+      }
+    } else {
+      std::uniform_int_distribution<std::size_t> dist(0, total_size - 1);
+      for (std::size_t i = 0; i < n; ++i) {
+        std::size_t g = dist(rng);
+        std::size_t s = 0;
+        while (g >= sizes[s]) {
+          g -= sizes[s];
+          ++s;
+        }
+        draws[i] = {s, static_cast<double>(g)};
+      }
+    }
+    std::sort(draws.begin(), draws.end(), [](const Draw& a, const Draw& b) { return a.shard < b.shard; });
+
+    out.slots.resize(n);
+    out.weights.assign(n, 1.0f);
+    double max_w = 0.0;
+    std::size_t i = 0;
+    while (i < n) {
+      const std::size_t s = draws[i].shard;
+      const Shard& sh = *shards_[s];
+      std::lock_guard<std::mutex> lock(sh.mu);
+      const std::size_t size = sh.records.size();
+      for (; i < n && draws[i].shard == s; ++i) {
+        std::size_t slot = 0;
+        if (weighted) {
+          // Las prioridades del shard pueden haber cambiado desde la foto:
+          // reescalar la clave a su masa actual.
+          const double mass = sh.tree.total();
+          const double u = masses[s] > 0.0 ? draws[i].key * (mass / masses[s]) : 0.0;
+          slot = std::min(sh.tree.find(std::min(u, std::nextafter(mass, 0.0))), size - 1);
+          // El redondeo puede dejar u sobre una hoja de prioridad 0 (slot sin usar).
+          if (sh.tree.get(slot) <= 0.0) {
+            slot = std::uniform_int_distribution<std::size_t>(0, size - 1)(rng);
+          }
+          const double prob = std::max(sh.tree.get(slot), 1e-12) / total_mass;
+          const double w = std::pow(static_cast<double>(total_size) * prob, -static_cast<double>(beta_));
+          out.weights[i] = static_cast<float>(w);
+          max_w = std::max(max_w, w);
+        } else {
+          slot = static_cast<std::size_t>(draws[i].key);
+        }
+        out.slots[i] = s * shard_capacity_ + slot;
+        visit(i, sh, slot);
+      }
+    }
+    if (max_w > 0.0) {
+      for (float& w : out.weights) {
+        w = static_cast<float>(w / max_w);
+      }
+    }
+    return n;
+  }
+
+  struct Record {
+    std::array<float, 4> policy{0.0f, 0.0f, 0.0f, 0.0f};
+    float outcome = 0.0f;
+    uint16_t head = PackedState::kNoCell;
+    uint16_t food = 0;
+    uint8_t direction = 3;
+  };
+
+  struct Shard {
+    mutable std::mutex mu;
+    std::vector<uint64_t> bits;
+    std::vector<Record> records;
+    std::size_t head = 0;
+    SumTree tree;
+    double max_priority = 1.0;
+  };
+
+  void add_range(Shard& sh, const std::vector<TrainingExample>& examples, std::size_t first, std::size_t last) {
+    std::lock_guard<std::mutex> lock(sh.mu);
+    for (std::size_t i = first; i < last; ++i) {
+      const TrainingExample& ex = examples[i];
+      std::size_t slot = sh.records.size();
+      if (slot < shard_capacity_) {
+        sh.records.emplace_back();
+        sh.bits.resize(sh.bits.size() + words_);
+      } else {
+        slot = sh.head;
+        sh.head = (sh.head + 1) % shard_capacity_;
+      }
+      std::copy_n(ex.state.occupancy.begin(), words_, sh.bits.begin() + static_cast<std::ptrdiff_t>(slot * words_));
+      Record& r = sh.records[slot];
+      r.policy = ex.policy;
+      r.outcome = ex.outcome;
+      r.head = ex.state.head;
+      r.food = ex.state.food;
+      r.direction = ex.state.direction;
+      if (prioritized_) {
+        sh.tree.set(slot, sh.max_priority);
+      }
+    }
+  }
+
+  int board_size_ = 20;
+  std::size_t words_ = 0;  // palabras de 64 bits por bitboard
+  std::size_t shard_capacity_ = 0;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<std::size_t> next_shard_{0};
+
+  bool prioritized_ = false;
+  float alpha_ = 0.6f;
+  float beta_ = 0.4f;
 };
 
 }  // namespace alphasnake
@@ -3,13 +3,11 @@
 #include <algorithm>
 #include <atomic>
 #include <chrono>
-#include <condition_variable>
-#include <deque>
 #include <filesystem>
 #include <fstream>
-#include <future>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <numeric>
 #include <random>
@@ -17,6 +15,7 @@
 #include <thread>
 
 #include "mcts/mcts.hpp"
+#include "train/inference_batcher.hpp"
 
 namespace fs = std::filesystem;
 
@@ -49,189 +48,139 @@ int sample_action(const std::array<float, 4>& pi, std::mt19937& rng) {
   return dd(rng);
 }
 
-std::string now_clock() {
-  const auto now = std::chrono::system_clock::now();
-  const auto t = std::chrono::system_clock::to_time_t(now);
-  std::tm tm{};
-#ifdef _WIN32
-  localtime_s(&tm, &t);
-#else
-  localtime_r(&t, &tm);
-#endif
-  std::ostringstream oss;
-  oss << std::put_time(&tm, "%Y-%m-%d %H:%M:%S");
-  return oss.str();
+// Playout cap randomization: sorteo de búsqueda completa por jugada. Con
+// full_search_prob >= 1 no consume el rng, así las partidas no cambian.
+bool draw_full_search(const TrainConfig& cfg, std::mt19937& rng) {
+  if (cfg.full_search_prob >= 1.0f) {
+    return true;
+  }
+  std::uniform_real_distribution<float> unif(0.0f, 1.0f);
+  return unif(rng) < cfg.full_search_prob;
 }
 
-class InferenceBatcher {
- public:
-  struct Stats {
-    long long requests = 0;
-    long long states = 0;
-    long long batches = 0;
-  };
-
-  InferenceBatcher(const PolicyValueModel& model, int max_batch, int wait_us)
-      : model_(model),
-        max_batch_(std::max(1, max_batch)),
-        wait_us_(std::max(1, wait_us)) {}
+// Seed de una partida de self-play a partir de su índice g, que ya es único
+// (next_game). En el loop serial g < games_per_iter; con el pipeline g crece
+// durante toda la corrida, así que se mezcla con splitmix64 en vez de sumarse
+// (una suma vuelve a chocar con los seeds de otra iteración).
+uint32_t selfplay_seed(const TrainConfig& cfg, int iteration, long long g, bool pipelined) {
+  if (!pipelined) {
+    return static_cast<uint32_t>(cfg.seed + iteration * 100000 + static_cast<int>(g));
+  }
+  uint64_t z = (static_cast<uint64_t>(static_cast<uint32_t>(cfg.seed)) << 32) ^
+               static_cast<uint64_t>(static_cast<uint32_t>(iteration));
+  z += 0x9E3779B97F4A7C15ULL * (static_cast<uint64_t>(g) + 1);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return static_cast<uint32_t>((z ^ (z >> 31)) >> 32);
+}
 
-  ~InferenceBatcher() { stop(); }
+int fast_search_simulations(const TrainConfig& cfg) {
+  return cfg.fast_simulations > 0 ? cfg.fast_simulations : std::max(1, cfg.num_simulations / 8);
+}
 
-  void start() {
-    bool expected = false;
-    if (!running_.compare_exchange_strong(expected, true)) {
-      return;
-    }
-    worker_ = std::thread(&InferenceBatcher::run_loop, this);
+// Retornos descontados: G_t = r_t + gamma * r_{t+1} + gamma² * r_{t+2} + ...
+// Esto da señal fuerte al value head: posiciones cerca de comida
+// reciben valores positivos, posiciones cerca de muerte negativos.
+// Las jugadas con búsqueda rápida llegan con política en cero (sin objetivo
+// de política); keep_value_only decide si quedan como ejemplos de solo valor.
+std::vector<TrainingExample> make_examples(const std::vector<PackedState>& states,
+                                           const std::vector<std::array<float, 4>>& policies,
+                                           const std::vector<float>& rewards,
+                                           float gamma,
+                                           bool keep_value_only) {
+  std::vector<float> returns(rewards.size(), 0.0f);
+  float G = 0.0f;
+  for (int t = static_cast<int>(rewards.size()) - 1; t >= 0; --t) {
+    G = rewards[static_cast<std::size_t>(t)] + gamma * G;
+    returns[static_cast<std::size_t>(t)] = std::max(-1.0f, std::min(1.0f, G));
   }
 
-  void stop() {
-    bool expected = true;
-    if (!running_.compare_exchange_strong(expected, false)) {
-      return;
-    }
-    cv_.notify_all();
-    if (worker_.joinable()) {
-      worker_.join();
+  std::vector<TrainingExample> examples;
+  examples.reserve(states.size());
+  for (std::size_t i = 0; i < states.size(); ++i) {
+    if (!keep_value_only && !has_policy_target(policies[i])) {
+      continue;
     }
+    TrainingExample ex;
+    ex.state = states[i];
+    ex.policy = policies[i];
+    ex.outcome = returns[i];
+    examples.push_back(std::move(ex));
   }
+  return examples;
+}
 
-  Prediction predict(const std::vector<float>& state) {
-    Request req;
-    req.state = state;
-    auto fut = req.promise.get_future();
-
-    {
-      std::lock_guard<std::mutex> lock(mu_);
-      queue_.push_back(std::move(req));
-      stats_requests_.fetch_add(1);
-      stats_states_.fetch_add(1);
-    }
-    cv_.notify_one();
-    return fut.get();
+void print_heartbeat(int completed,
+                     int games,
+                     long long positions,
+                     long long batches,
+                     long long states,
+                     int target_batch,
+                     const std::string& tuning = "") {
+  const double avg_states = batches > 0 ? static_cast<double>(states) / batches : 0.0;
+  std::cout << "      [Heartbeat] games=" << completed;
+  if (games > 0) {
+    std::cout << "/" << games;
   }
-
-  // Enviar múltiples estados de golpe al batcher.
-  // Todos se encolan juntos y pueden caer en el mismo batch GPU,
-  // eliminando k round-trips secuenciales (usado por food stochasticity).
-  std::vector<Prediction> predict_many(const std::vector<std::vector<float>>& states) {
-    if (states.empty()) {
-      return {};
-    }
-    if (states.size() == 1) {
-      return {predict(states[0])};
-    }
-
-    std::vector<std::future<Prediction>> futures;
-    futures.reserve(states.size());
-
-    {
-      std::lock_guard<std::mutex> lock(mu_);
-      for (const auto& state : states) {
-        Request req;
-        req.state = state;
-        futures.push_back(req.promise.get_future());
-        queue_.push_back(std::move(req));
-      }
-      stats_requests_.fetch_add(static_cast<long long>(states.size()));
-      stats_states_.fetch_add(static_cast<long long>(states.size()));
-    }
-    cv_.notify_one();
-
-    std::vector<Prediction> results;
-    results.reserve(futures.size());
-    for (auto& f : futures) {
-      results.push_back(f.get());
-    }
-    return results;
+  std::cout << " | positions=" << positions
+            << " | batches=" << batches
+            << " | avg_batch=" << std::fixed << std::setprecision(1) << avg_states
+            << std::defaultfloat << std::setprecision(6);
+  std::cout << tuning;
+  if (avg_states > 0.0 && avg_states < static_cast<double>(target_batch) * 0.25) {
+    std::cout << " [WARN: batch bajo, GPU ociosa]";
   }
+  std::cout << "\n";
+}
 
-  [[nodiscard]] Stats stats() const {
-    Stats s;
-    s.requests = stats_requests_.load();
-    s.states = stats_states_.load();
-    s.batches = stats_batches_.load();
-    return s;
+// Aciertos del cache desde `since` (los contadores del cache son acumulados).
+std::string cache_summary(const PredictionCache& cache, const PredictionCache::Stats& since) {
+  if (!cache.enabled()) {
+    return "";
   }
+  const PredictionCache::Stats now = cache.stats();
+  PredictionCache::Stats d;
+  d.lookups = now.lookups - since.lookups;
+  d.hits = now.hits - since.hits;
+  std::ostringstream oss;
+  oss << " | cache_hit=" << std::fixed << std::setprecision(1) << 100.0 * d.hit_rate() << "% ("
+      << d.hits << "/" << d.lookups << ")";
+  return oss.str();
+}
 
- private:
-  struct Request {
-    std::vector<float> state;
-    std::promise<Prediction> promise;
-  };
-
-  void run_loop() {
-    while (true) {
-      std::vector<Request> batch;
-      {
-        std::unique_lock<std::mutex> lock(mu_);
-        cv_.wait(lock, [&]() { return !queue_.empty() || !running_.load(); });
-
-        if (queue_.empty() && !running_.load()) {
-          break;
-        }
-
-        const auto deadline =
-            std::chrono::steady_clock::now() + std::chrono::microseconds(wait_us_);
-        while (queue_.size() < static_cast<std::size_t>(max_batch_) && running_.load()) {
-          if (cv_.wait_until(lock, deadline) == std::cv_status::timeout) {
-            break;
-          }
-        }
-
-        const std::size_t take =
-            std::min<std::size_t>(queue_.size(), static_cast<std::size_t>(max_batch_));
-        batch.reserve(take);
-        for (std::size_t i = 0; i < take; ++i) {
-          batch.emplace_back(std::move(queue_.front()));
-          queue_.pop_front();
-        }
-      }
-
-      if (batch.empty()) {
-        continue;
-      }
-
-      std::vector<std::vector<float>> states;
-      states.reserve(batch.size());
-      for (const auto& req : batch) {
-        states.push_back(req.state);
-      }
-
-      std::vector<Prediction> preds = model_.predict_batch(states);
-      if (preds.size() != batch.size()) {
-        preds.assign(batch.size(), Prediction{});
-      }
-
-      for (std::size_t i = 0; i < batch.size(); ++i) {
-        batch[i].promise.set_value(preds[i]);
-      }
-      stats_batches_.fetch_add(1);
-    }
+std::string playout_cap_summary(const TrainConfig& cfg) {
+  if (cfg.full_search_prob >= 1.0f) {
+    return "";
   }
+  std::ostringstream oss;
+  oss << " (full_prob=" << cfg.full_search_prob << " fast_sims=" << fast_search_simulations(cfg) << ")";
+  return oss.str();
+}
 
-  const PolicyValueModel& model_;
-  int max_batch_ = 256;
-  int wait_us_ = 1000;
-
-  mutable std::mutex mu_;
-  std::condition_variable cv_;
-  std::deque<Request> queue_;
-
-  std::atomic<bool> running_{false};
-  std::thread worker_;
-
-  std::atomic<long long> stats_requests_{0};
-  std::atomic<long long> stats_states_{0};
-  std::atomic<long long> stats_batches_{0};
-};
+std::string now_clock() {
+  const auto now = std::chrono::system_clock::now();
+  const auto t = std::chrono::system_clock::to_time_t(now);
+  std::tm tm{};
+#ifdef _WIN32
+  localtime_s(&tm, &t);
+#else
+  localtime_r(&t, &tm);
+#endif
+  std::ostringstream oss;
+  oss << std::put_time(&tm, "%Y-%m-%d %H:%M:%S");
+  return oss.str();
+}
 
 }  // namespace
 
 AlphaSnakeTrainer::AlphaSnakeTrainer(const TrainConfig& cfg)
     : cfg_(cfg),
-      buffer_(cfg.buffer_size),
+      buffer_(cfg.buffer_size,
+              cfg.board_size,
+              cfg.prioritized_replay,
+              cfg.priority_alpha,
+              cfg.priority_beta,
+              cfg.replay_shards),
       best_model_(cfg.board_size,
                   cfg.model_channels,
                   cfg.model_blocks,
@@ -243,7 +192,14 @@ AlphaSnakeTrainer::AlphaSnakeTrainer(const TrainConfig& cfg)
                        cfg.model_blocks,
                        static_cast<uint32_t>(cfg.seed + 1),
                        cfg.lr,
-                       cfg.weight_decay) {}
+                       cfg.weight_decay),
+      cache_(static_cast<std::size_t>(std::max(0, cfg.prediction_cache_entries))),
+      snapshot_model_(cfg.board_size,
+                      cfg.model_channels,
+                      cfg.model_blocks,
+                      static_cast<uint32_t>(cfg.seed + 2),
+                      cfg.lr,
+                      cfg.weight_decay) {}
 
 bool AlphaSnakeTrainer::ensure_dirs(std::string& error) const {
   std::error_code ec;
@@ -255,7 +211,10 @@ bool AlphaSnakeTrainer::ensure_dirs(std::string& error) const {
   return true;
 }
 
-bool AlphaSnakeTrainer::save_checkpoint(int iteration, std::string& error) const {
+bool AlphaSnakeTrainer::save_checkpoint(int iteration,
+                                        const PolicyValueModel& candidate,
+                                        float best_win_rate,
+                                        std::string& error) const {
   const std::string best_path = cfg_.save_dir + "/best_model.bin";
   const std::string cand_path = cfg_.save_dir + "/candidate_model.bin";
   const std::string state_path = cfg_.save_dir + "/trainer_state.txt";
@@ -263,7 +222,7 @@ bool AlphaSnakeTrainer::save_checkpoint(int iteration, std::string& error) const
   if (!best_model_.save(best_path, error)) {
     return false;
   }
-  if (!candidate_model_.save(cand_path, error)) {
+  if (!candidate.save(cand_path, error)) {
     return false;
   }
 
@@ -273,7 +232,7 @@ bool AlphaSnakeTrainer::save_checkpoint(int iteration, std::string& error) const
     return false;
   }
   out << "iteration=" << iteration << "\n";
-  out << "best_win_rate=" << best_win_rate_ << "\n";
+  out << "best_win_rate=" << best_win_rate << "\n";
   out << "profile=" << cfg_.profile << "\n";
   out << "updated_at=" << now_clock() << "\n";
   return true;
@@ -326,22 +285,30 @@ std::vector<TrainingExample> AlphaSnakeTrainer::play_single_game(PredictFn predi
   SnakeEnv env(cfg_.board_size, cfg_.max_steps, seed);
   std::mt19937 rng(seed);
 
-  std::vector<std::vector<float>> states;
+  std::vector<PackedState> states;
   std::vector<std::array<float, 4>> policies;
   std::vector<float> rewards;
 
+  // Un MCTS por juego: la arena de nodos queda reservada entre movimientos.
+  MCTS mcts(cfg_, std::move(predict_fn), std::move(batch_predict_fn), seed);
+
   int move = 0;
   while (!env.is_done()) {
     const float temp = (move < cfg_.temp_decay_move) ? 1.0f : 0.0f;
-    MCTS mcts(cfg_, predict_fn, batch_predict_fn, seed + static_cast<uint32_t>(move * 31 + 7));
-    std::array<float, 4> pi = mcts.search(env, add_root_noise, temp);
+    // Búsqueda rápida: sin ruido en la raíz y sin objetivo de política.
+    const bool full = draw_full_search(cfg_, rng);
+    mcts.set_simulation_limit(full ? cfg_.num_simulations : fast_search_simulations(cfg_));
+    mcts.reseed(seed + static_cast<uint32_t>(move * 31 + 7));
+    std::array<float, 4> pi = mcts.search(env, add_root_noise && full, temp);
 
-    states.push_back(env.get_state());
-    policies.push_back(pi);
+    states.push_back(env.pack_state());
+    policies.push_back(full ? pi : std::array<float, 4>{});
 
-    const int action = sample_action(pi, rng);
+    // Con gumbel pi es el objetivo mejorado y la jugada sale del halving.
+    const int action = cfg_.gumbel ? mcts.selected_action() : sample_action(pi, rng);
     StepResult step = env.step(action);
     rewards.push_back(step.reward);
+    mcts.advance(action, env);
 
     ++move;
     if (move > cfg_.max_steps + 8) {
@@ -349,30 +316,14 @@ std::vector<TrainingExample> AlphaSnakeTrainer::play_single_game(PredictFn predi
     }
   }
 
-  // Discounted returns: calcular retorno descontado por posición.
-  // G_t = r_t + gamma * r_{t+1} + gamma² * r_{t+2} + ...
-  // Esto da señal fuerte al value head: posiciones cerca de comida
-  // reciben valores positivos, posiciones cerca de muerte negativos.
-  std::vector<float> returns(rewards.size(), 0.0f);
-  float G = 0.0f;
-  for (int t = static_cast<int>(rewards.size()) - 1; t >= 0; --t) {
-    G = rewards[static_cast<std::size_t>(t)] + cfg_.gamma * G;
-    returns[static_cast<std::size_t>(t)] = std::max(-1.0f, std::min(1.0f, G));
-  }
+  return make_examples(states, policies, rewards, cfg_.gamma, cfg_.fast_value_targets);
+}
 
-  std::vector<TrainingExample> examples;
-  examples.reserve(states.size());
-  for (std::size_t i = 0; i < states.size(); ++i) {
-    TrainingExample ex;
-    ex.state = std::move(states[i]);
-    ex.policy = policies[i];
-    ex.outcome = returns[i];
-    examples.push_back(std::move(ex));
+long long AlphaSnakeTrainer::run_self_play(int iteration, const std::atomic<bool>* stop) {
+  if (cfg_.selfplay_games_per_thread > 0) {
+    return run_self_play_multiplexed(iteration, stop);
   }
-  return examples;
-}
 
-std::vector<TrainingExample> AlphaSnakeTrainer::run_self_play(int iteration) {
   // GPU es el cuello de botella principal: usar el número de workers
   // configurado sin inflar artificialmente. Más workers solo agregan
   // overhead de hilos cuando la GPU ya está saturada.
@@ -380,64 +331,61 @@ std::vector<TrainingExample> AlphaSnakeTrainer::run_self_play(int iteration) {
   const int workers = std::max(1, std::min(cfg_.selfplay_workers, cfg_.games_per_iter));
 
   std::cout << "  [Self-play] workers=" << workers << " games=" << cfg_.games_per_iter
-            << " sims=" << cfg_.num_simulations
+            << " sims=" << cfg_.num_simulations << playout_cap_summary(cfg_)
             << " (hw_threads=" << hw << ")\n";
 
-  std::vector<TrainingExample> all_examples;
-  all_examples.reserve(static_cast<std::size_t>(cfg_.games_per_iter * 64));
-
-  std::mutex data_mu;
-  std::atomic<int> next_game{0};
+  // Cada juego terminado va directo al replay buffer (shards con lock propio).
+  // Con stop (pipeline) no hay tope de juegos: se juega hasta que lo pidan.
+  auto more_games = [&](long long g) { return stop != nullptr ? !stop->load() : g < cfg_.games_per_iter; };
+  std::atomic<long long> next_game{0};
   std::atomic<int> completed{0};
   std::atomic<long long> total_positions{0};
-  InferenceBatcher infer_server(best_model_, cfg_.inference_batch_size, cfg_.inference_wait_us);
+  const PredictionCache::Stats cache_start = cache_.stats();
+  InferenceBatcher infer_server(best_model_, cfg_.inference_batch_size, cfg_.inference_wait_us,
+                                cfg_.inference_latency_cap_us, &cache_);
   infer_server.start();
 
   std::vector<std::thread> pool;
   pool.reserve(static_cast<std::size_t>(workers));
 
   for (int w = 0; w < workers; ++w) {
-    pool.emplace_back([&, w]() {
-      auto predict_fn = [&infer_server](const std::vector<float>& state) {
-        return infer_server.predict(state);
+    pool.emplace_back([&]() {
+      auto predict_fn = [&infer_server](const SnakeEnv& env) {
+        return infer_server.predict(env);
       };
-      auto batch_predict_fn = [&infer_server](const std::vector<std::vector<float>>& states) {
-        return infer_server.predict_many(states);
+      auto batch_predict_fn = [&infer_server](const std::vector<const SnakeEnv*>& envs) {
+        return infer_server.predict_many(envs);
       };
       while (true) {
-        const int g = next_game.fetch_add(1);
-        if (g >= cfg_.games_per_iter) {
+        const long long g = next_game.fetch_add(1);
+        if (!more_games(g)) {
           break;
         }
-        const uint32_t seed = static_cast<uint32_t>(
-            cfg_.seed + iteration * 100000 + w * 1000 + g);
+        const uint32_t seed = selfplay_seed(cfg_, iteration, g, stop != nullptr);
         auto ex = play_single_game(predict_fn, batch_predict_fn, seed, true);
 
         total_positions.fetch_add(static_cast<long long>(ex.size()));
-        {
-          std::lock_guard<std::mutex> lock(data_mu);
-          all_examples.insert(all_examples.end(),
-                              std::make_move_iterator(ex.begin()),
-                              std::make_move_iterator(ex.end()));
-        }
+        buffer_.add_many(ex);
+        positions_played_.fetch_add(static_cast<long long>(ex.size()));
+        games_played_.fetch_add(1);
         completed.fetch_add(1);
       }
     });
   }
 
-  while (completed.load() < cfg_.games_per_iter) {
+  while (stop != nullptr ? !stop->load() : completed.load() < cfg_.games_per_iter) {
     std::this_thread::sleep_for(std::chrono::seconds(2));
     const auto st = infer_server.stats();
-    const double avg_states = st.batches > 0 ? static_cast<double>(st.states) / st.batches : 0.0;
-    std::cout << "      [Heartbeat] games=" << completed.load() << "/" << cfg_.games_per_iter
-              << " | positions=" << total_positions.load()
-              << " | batches=" << st.batches
-              << " | avg_batch=" << std::fixed << std::setprecision(1) << avg_states
-              << std::defaultfloat << std::setprecision(6);
-    if (avg_states > 0.0 && avg_states < static_cast<double>(cfg_.inference_batch_size) * 0.25) {
-      std::cout << " [WARN: batch bajo, GPU ociosa]";
+    std::ostringstream tuning;
+    if (cfg_.inference_latency_cap_us > 0) {
+      tuning << " | target=" << st.target_batch << " wait=" << st.wait_us << "us"
+             << " | arrivals=" << static_cast<long long>(st.arrival_per_sec) << "/s"
+             << " | model=" << static_cast<long long>(st.batch_latency_us) << "us";
     }
-    std::cout << "\n";
+    tuning << cache_summary(cache_, cache_start);
+    print_heartbeat(completed.load(), stop != nullptr ? 0 : cfg_.games_per_iter, total_positions.load(),
+                    static_cast<long long>(st.batches), static_cast<long long>(st.states),
+                    cfg_.inference_batch_size, tuning.str());
   }
 
   for (auto& th : pool) {
@@ -445,8 +393,221 @@ std::vector<TrainingExample> AlphaSnakeTrainer::run_self_play(int iteration) {
   }
   infer_server.stop();
 
-  std::cout << "  [Self-play] completado | posiciones=" << all_examples.size() << "\n";
-  return all_examples;
+  std::cout << "  [Self-play] completado | posiciones=" << total_positions.load()
+            << cache_summary(cache_, cache_start) << "\n";
+  return total_positions.load();
+}
+
+long long AlphaSnakeTrainer::run_self_play_multiplexed(int iteration, const std::atomic<bool>* stop) {
+  // Un hilo por core, cada uno con varios juegos en vuelo. Cada MCTS es una
+  // máquina de estados (begin_search / collect_leaves / apply_evaluations):
+  // el hilo junta las hojas pendientes de todos sus juegos y las evalúa en un
+  // solo predict_batch, sin InferenceBatcher ni promise/future por pedido.
+  const int hw = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  const int threads = std::max(1, std::min(hw, cfg_.games_per_iter));
+  const int slots_per_thread = std::max(
+      1, std::min(cfg_.selfplay_games_per_thread, (cfg_.games_per_iter + threads - 1) / threads));
+
+  std::cout << "  [Self-play] threads=" << threads << " games_per_thread=" << slots_per_thread
+            << " games=" << cfg_.games_per_iter << " sims=" << cfg_.num_simulations
+            << playout_cap_summary(cfg_) << " leaf_batch=" << std::max(1, cfg_.leaf_batch_size) << "\n";
+
+  auto more_games = [&](long long g) { return stop != nullptr ? !stop->load() : g < cfg_.games_per_iter; };
+  std::atomic<long long> next_game{0};
+  std::atomic<int> completed{0};
+  std::atomic<long long> total_positions{0};
+  std::atomic<long long> batches{0};
+  std::atomic<long long> batch_states{0};
+  const PredictionCache::Stats cache_start = cache_.stats();
+
+  struct GameSlot {
+    explicit GameSlot(const TrainConfig& cfg)
+        : env(cfg.board_size, cfg.max_steps, 0), mcts(cfg, MCTS::PredictFn{}, 0) {}
+
+    SnakeEnv env;
+    MCTS mcts;
+    std::mt19937 rng;
+    uint32_t seed = 0;
+    int move = 0;
+    bool searching = false;
+    bool full = true;  // búsqueda en curso: completa o rápida
+    std::size_t batch_begin = 0;
+    int batch_count = 0;
+    std::vector<PackedState> states;
+    std::vector<std::array<float, 4>> policies;
+    std::vector<float> rewards;
+  };
+
+  std::vector<std::thread> pool;
+  pool.reserve(static_cast<std::size_t>(threads));
+
+  for (int t = 0; t < threads; ++t) {
+    pool.emplace_back([&]() {
+      auto start_game = [&](GameSlot& s) {
+        const long long g = next_game.fetch_add(1);
+        if (!more_games(g)) {
+          return false;
+        }
+        s.seed = selfplay_seed(cfg_, iteration, g, stop != nullptr);
+        s.env = SnakeEnv(cfg_.board_size, cfg_.max_steps, s.seed);
+        s.rng.seed(s.seed);
+        s.mcts.clear_tree();
+        s.move = 0;
+        s.searching = false;
+        s.states.clear();
+        s.policies.clear();
+        s.rewards.clear();
+        return true;
+      };
+
+      // Juegos en vuelo de este hilo; al terminar uno se arranca el siguiente
+      // en el mismo slot (reusa env, arena del MCTS y buffers).
+      std::vector<std::unique_ptr<GameSlot>> active;
+      for (int i = 0; i < slots_per_thread; ++i) {
+        auto s = std::make_unique<GameSlot>(cfg_);
+        if (!start_game(*s)) {
+          break;
+        }
+        active.push_back(std::move(s));
+      }
+
+      const int dim = best_model_.input_dim();
+      std::vector<const SnakeEnv*> batch;
+      std::vector<float> staging;
+      std::vector<Prediction> preds;
+      std::vector<std::size_t> misses;
+      std::vector<Prediction> miss_preds;
+
+      while (!active.empty()) {
+        batch.clear();
+        for (std::size_t i = 0; i < active.size();) {
+          GameSlot& s = *active[i];
+          s.batch_count = 0;
+          bool finished = false;
+          while (true) {
+            if (!s.searching) {
+              s.full = draw_full_search(cfg_, s.rng);
+              s.mcts.set_simulation_limit(s.full ? cfg_.num_simulations : fast_search_simulations(cfg_));
+              s.mcts.reseed(s.seed + static_cast<uint32_t>(s.move * 31 + 7));
+              s.mcts.begin_search(s.env, s.full, s.move >= cfg_.temp_decay_move);
+              s.searching = true;
+            }
+            s.batch_begin = batch.size();
+            s.batch_count = s.mcts.collect_leaves(batch);
+            if (s.batch_count > 0) {
+              break;
+            }
+
+            // Búsqueda terminada: jugar el movimiento (igual que play_single_game).
+            s.searching = false;
+            const float temp = (s.move < cfg_.temp_decay_move) ? 1.0f : 0.0f;
+            const std::array<float, 4> pi = s.mcts.finish_search(temp);
+            s.states.push_back(s.env.pack_state());
+            s.policies.push_back(s.full ? pi : std::array<float, 4>{});
+            const int action = cfg_.gumbel ? s.mcts.selected_action() : sample_action(pi, s.rng);
+            const StepResult step = s.env.step(action);
+            s.rewards.push_back(step.reward);
+            s.mcts.advance(action, s.env);
+            ++s.move;
+
+            if (s.env.is_done() || s.move > cfg_.max_steps + 8) {
+              auto ex = make_examples(s.states, s.policies, s.rewards, cfg_.gamma, cfg_.fast_value_targets);
+              total_positions.fetch_add(static_cast<long long>(ex.size()));
+              buffer_.add_many(ex);
+              positions_played_.fetch_add(static_cast<long long>(ex.size()));
+              games_played_.fetch_add(1);
+              completed.fetch_add(1);
+              if (!start_game(s)) {
+                finished = true;
+                break;
+              }
+            }
+          }
+          if (finished) {
+            active[i] = std::move(active.back());
+            active.pop_back();
+          } else {
+            ++i;
+          }
+        }
+
+        if (batch.empty()) {
+          continue;
+        }
+        const std::size_t n = batch.size();
+        preds.assign(n, Prediction{});
+        // Los aciertos del cache se resuelven acá; solo los demás van al modelo.
+        const uint64_t version = best_model_.weights_version();
+        misses.clear();
+        for (std::size_t i = 0; i < n; ++i) {
+          if (!cache_.lookup(batch[i]->hash(), version, preds[i])) {
+            misses.push_back(i);
+          }
+        }
+        const std::size_t m = misses.size();
+        if (m > 0 && batch[0]->state_size() == dim) {
+          staging.resize(m * static_cast<std::size_t>(dim));
+          miss_preds.assign(m, Prediction{});
+          dispatch_board_size(cfg_.board_size, [&](auto b) {
+            for (std::size_t j = 0; j < m; ++j) {
+              batch[misses[j]]->encode_state_fixed<decltype(b)::value>(staging.data() +
+                                                                       j * static_cast<std::size_t>(dim));
+            }
+          });
+          best_model_.predict_batch(staging.data(), static_cast<int64_t>(m), miss_preds.data());
+          for (std::size_t j = 0; j < m; ++j) {
+            preds[misses[j]] = miss_preds[j];
+            cache_.store(batch[misses[j]]->hash(), version, miss_preds[j]);
+          }
+          batches.fetch_add(1);
+          batch_states.fetch_add(static_cast<long long>(m));
+        }
+
+        for (auto& sp : active) {
+          if (sp->batch_count > 0) {
+            sp->mcts.apply_evaluations(preds.data() + sp->batch_begin);
+          }
+        }
+      }
+    });
+  }
+
+  while (stop != nullptr ? !stop->load() : completed.load() < cfg_.games_per_iter) {
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+    print_heartbeat(completed.load(), stop != nullptr ? 0 : cfg_.games_per_iter, total_positions.load(),
+                    batches.load(), batch_states.load(),
+                    slots_per_thread * std::max(1, cfg_.leaf_batch_size),
+                    cache_summary(cache_, cache_start));
+  }
+
+  for (auto& th : pool) {
+    th.join();
+  }
+
+  std::cout << "  [Self-play] completado | posiciones=" << total_positions.load()
+            << cache_summary(cache_, cache_start) << "\n";
+  return total_positions.load();
+}
+
+LossStats AlphaSnakeTrainer::train_step(BatchPrefetcher& loader, std::vector<float>& example_losses) {
+  BatchPrefetcher::Slot* slot = loader.acquire();
+  if (slot == nullptr) {
+    return LossStats{};
+  }
+  LossStats ls{};
+  if (!buffer_.prioritized()) {
+    ls = candidate_model_.train_batch(slot->batch, cfg_.lr, cfg_.weight_decay);
+  } else {
+    // La loss de cada ejemplo pasa a ser su prioridad en el sum-tree. El
+    // batch se muestreó hasta prefetch_batches pasos antes, así que puede no
+    // ver las prioridades de esos pasos: mismo sesgo que un learner async.
+    example_losses.resize(static_cast<std::size_t>(slot->batch.size));
+    ls = candidate_model_.train_batch(slot->batch, cfg_.lr, cfg_.weight_decay, example_losses.data());
+    buffer_.update_priorities(slot->info, example_losses.data());
+  }
+  // train_batch ya sincronizó las copias al device: el slot se puede reusar.
+  loader.release(slot);
+  return ls;
 }
 
 LossStats AlphaSnakeTrainer::train_candidate(std::mt19937& rng) {
@@ -463,11 +624,15 @@ LossStats AlphaSnakeTrainer::train_candidate(std::mt19937& rng) {
   const std::size_t dataset = buffer_.size();
   const int steps_per_epoch = std::max(1, static_cast<int>(dataset / cfg_.batch_size));
 
+  // Los loaders arman los próximos batches mientras corre el paso actual.
+  BatchPrefetcher loader(buffer_, candidate_model_, cfg_.batch_size, cfg_.prefetch_batches, cfg_.prefetch_loaders,
+                         rng());
+  loader.start();
+  std::vector<float> example_losses;
   for (int epoch = 0; epoch < cfg_.epochs_per_iter; ++epoch) {
     LossStats avg{};
     for (int step = 0; step < steps_per_epoch; ++step) {
-      auto batch = buffer_.sample(static_cast<std::size_t>(cfg_.batch_size), rng);
-      LossStats ls = candidate_model_.train_batch(batch, cfg_.lr, cfg_.weight_decay);
+      const LossStats ls = train_step(loader, example_losses);
       avg.total += ls.total;
       avg.policy += ls.policy;
       avg.value += ls.value;
@@ -495,7 +660,8 @@ EvalMetrics AlphaSnakeTrainer::evaluate_model(const PolicyValueModel& model,
   const int hw = static_cast<int>(std::thread::hardware_concurrency());
   const int eval_workers = std::max(1, std::min(games, std::max(16, hw * 2)));
 
-  InferenceBatcher infer_server(model, cfg_.inference_batch_size, cfg_.inference_wait_us);
+  InferenceBatcher infer_server(model, cfg_.inference_batch_size, cfg_.inference_wait_us,
+                                cfg_.inference_latency_cap_us, &cache_);
   infer_server.start();
 
   std::atomic<int> wins{0};
@@ -508,11 +674,11 @@ EvalMetrics AlphaSnakeTrainer::evaluate_model(const PolicyValueModel& model,
 
   for (int w = 0; w < eval_workers; ++w) {
     pool.emplace_back([&]() {
-      auto predict_fn = [&infer_server](const std::vector<float>& state) {
-        return infer_server.predict(state);
+      auto predict_fn = [&infer_server](const SnakeEnv& env) {
+        return infer_server.predict(env);
       };
-      auto batch_predict_fn = [&infer_server](const std::vector<std::vector<float>>& states) {
-        return infer_server.predict_many(states);
+      auto batch_predict_fn = [&infer_server](const std::vector<const SnakeEnv*>& envs) {
+        return infer_server.predict_many(envs);
       };
       while (true) {
         const int g = next_game.fetch_add(1);
@@ -523,12 +689,15 @@ EvalMetrics AlphaSnakeTrainer::evaluate_model(const PolicyValueModel& model,
             cfg_.seed + iteration_seed * 100000 + g);
         SnakeEnv env(cfg_.board_size, cfg_.max_steps, seed);
 
+        MCTS mcts(cfg_, predict_fn, batch_predict_fn, seed);
+
         int move = 0;
         while (!env.is_done()) {
-          MCTS mcts(cfg_, predict_fn, batch_predict_fn, seed + static_cast<uint32_t>(move * 17 + 3));
+          mcts.reseed(seed + static_cast<uint32_t>(move * 17 + 3));
           std::array<float, 4> pi = mcts.search(env, false, 0.0f);
-          const int action = argmax4(pi);
+          const int action = cfg_.gumbel ? mcts.selected_action() : argmax4(pi);
           env.step(action);
+          mcts.advance(action, env);
           ++move;
           if (move > cfg_.max_steps + 8) {
             break;
@@ -573,10 +742,21 @@ bool AlphaSnakeTrainer::run(bool resume, std::string& error) {
   std::cout << " Board: " << cfg_.board_size << "x" << cfg_.board_size << "\n";
   std::cout << " Simulations: " << cfg_.num_simulations << "\n";
   std::cout << " Games/iter: " << cfg_.games_per_iter << "\n";
+  if (cfg_.pipeline) {
+    std::cout << " Pipeline: async (sample_ratio=" << cfg_.sample_ratio << ")\n";
+  }
+  if (cfg_.prioritized_replay) {
+    std::cout << " Replay: prioritized (alpha=" << cfg_.priority_alpha << ", beta=" << cfg_.priority_beta
+              << ")\n";
+  }
   std::cout << " Model device: " << best_model_.device_string() << "\n";
   std::cout << " Save dir: " << cfg_.save_dir << "\n";
   std::cout << "============================================================\n\n";
 
+  if (cfg_.pipeline) {
+    return run_pipelined(rng, error);
+  }
+
   const int end_iteration = start_iteration_ + cfg_.iterations;
 
   for (int iter = start_iteration_ + 1; iter <= end_iteration; ++iter) {
@@ -585,21 +765,24 @@ bool AlphaSnakeTrainer::run(bool resume, std::string& error) {
     std::cout << "============================================================\n";
     std::cout << "  [Iter " << iter << "] Inicio: " << now_clock() << "\n";
 
-    std::vector<TrainingExample> new_examples = run_self_play(iter);
-    buffer_.add_many(new_examples);
+    run_self_play(iter);
 
-    std::cout << "  [Train] buffer=" << buffer_.size() << "\n";
+    std::cout << "  [Train] buffer=" << buffer_.size() << " ("
+              << buffer_.memory_bytes() / (1024 * 1024) << " MB)\n";
     LossStats losses = train_candidate(rng);
     std::cout << "  [Train] loss=" << losses.total << " (p=" << losses.policy
               << ", v=" << losses.value << ")\n";
 
     // Evaluar ambos modelos con los MISMOS seeds para comparación justa.
+    const PredictionCache::Stats cache_eval_best = cache_.stats();
     EvalMetrics eval_best = evaluate_model(best_model_, cfg_.eval_games, iter);
+    const std::string best_cache = cache_summary(cache_, cache_eval_best);
+    const PredictionCache::Stats cache_eval_new = cache_.stats();
     EvalMetrics eval_new = evaluate_model(candidate_model_, cfg_.eval_games, iter);
     std::cout << "  [Eval best]      win=" << eval_best.win_rate
-              << " avg_len=" << eval_best.avg_length << "\n";
+              << " avg_len=" << eval_best.avg_length << best_cache << "\n";
     std::cout << "  [Eval candidate] win=" << eval_new.win_rate
-              << " avg_len=" << eval_new.avg_length << "\n";
+              << " avg_len=" << eval_new.avg_length << cache_summary(cache_, cache_eval_new) << "\n";
 
     // Aceptar si el candidato logra mejor longitud promedio en los mismos juegos.
     const bool accept = eval_new.avg_length >= eval_best.avg_length;
@@ -613,7 +796,7 @@ bool AlphaSnakeTrainer::run(bool resume, std::string& error) {
                 << " > candidate=" << eval_new.avg_length << ")\n";
     }
 
-    if (!save_checkpoint(iter, error)) {
+    if (!save_checkpoint(iter, candidate_model_, best_win_rate_, error)) {
       return false;
     }
 
@@ -623,4 +806,152 @@ bool AlphaSnakeTrainer::run(bool resume, std::string& error) {
   return true;
 }
 
+bool AlphaSnakeTrainer::run_pipelined(std::mt19937& rng, std::string& error) {
+  // Tres etapas en paralelo: los actores juegan sin parar contra best_model_
+  // (copy_from lo actualiza en el lugar al aceptar), el learner entrena
+  // candidate_model_ sin reiniciarlo y este hilo hace de evaluador: cada
+  // games_per_iter juegos toma una foto del candidato, la compara con best y
+  // deja el checkpoint a otro hilo. El tiempo por iteración tiende al de la
+  // etapa más lenta en vez de a la suma de todas.
+  candidate_model_.copy_from(best_model_);
+  candidate_model_.reset_optimizer(cfg_.lr, cfg_.weight_decay);
+
+  const int end_iteration = start_iteration_ + cfg_.iterations;
+  const long long games_start = games_played_.load();
+  const long long positions_start = positions_played_.load();
+  std::atomic<bool> stop_actors{false};
+  std::atomic<bool> stop_learner{false};
+
+  std::thread actors([&]() { run_self_play(start_iteration_ + 1, &stop_actors); });
+
+  // Learner: a lo sumo sample_ratio ejemplos entrenados por ejemplo insertado;
+  // si va adelantado espera a los actores en vez de sobreajustar el buffer.
+  std::mutex loss_mu;
+  LossStats loss_sum{};
+  long long loss_steps = 0;
+  std::atomic<long long> trained{0};
+  std::thread learner([&, seed = rng()]() {
+    BatchPrefetcher loader(buffer_, candidate_model_, cfg_.batch_size, cfg_.prefetch_batches, cfg_.prefetch_loaders,
+                           seed);
+    loader.start();
+    std::vector<float> example_losses;
+    const long long batch = cfg_.batch_size;
+    while (!stop_learner.load()) {
+      // Como en train_candidate: sin un batch completo en el buffer el
+      // prefetcher no publica nada y acquire() no volvería.
+      const long long inserted = positions_played_.load() - positions_start;
+      if (inserted < batch || buffer_.size() < static_cast<std::size_t>(batch) ||
+          static_cast<double>(trained.load() + batch) > cfg_.sample_ratio * static_cast<double>(inserted)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+      const LossStats ls = train_step(loader, example_losses);
+      trained.fetch_add(batch);
+      std::lock_guard<std::mutex> lock(loss_mu);
+      loss_sum.total += ls.total;
+      loss_sum.policy += ls.policy;
+      loss_sum.value += ls.value;
+      ++loss_steps;
+    }
+  });
+
+  std::thread checkpoint;
+  std::string checkpoint_error;
+  bool ok = true;
+  for (int iter = start_iteration_ + 1; iter <= end_iteration; ++iter) {
+    const auto iter_start = std::chrono::steady_clock::now();
+    const long long target = games_start + static_cast<long long>(iter - start_iteration_) * cfg_.games_per_iter;
+    while (games_played_.load() < target) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    std::cout << "\n============================================================\n";
+    std::cout << " ITERACION " << iter << " / " << end_iteration << " (pipeline)\n";
+    std::cout << "============================================================\n";
+    std::cout << "  [Iter " << iter << "] Inicio eval: " << now_clock() << "\n";
+
+    // La foto anterior tiene que estar en disco antes de pisarla.
+    if (checkpoint.joinable()) {
+      checkpoint.join();
+    }
+    if (!checkpoint_error.empty()) {
+      error = checkpoint_error;
+      ok = false;
+      break;
+    }
+    snapshot_model_.copy_from(candidate_model_);
+
+    LossStats losses{};
+    long long steps = 0;
+    {
+      std::lock_guard<std::mutex> lock(loss_mu);
+      steps = loss_steps;
+      if (steps > 0) {
+        losses.total = loss_sum.total / static_cast<float>(steps);
+        losses.policy = loss_sum.policy / static_cast<float>(steps);
+        losses.value = loss_sum.value / static_cast<float>(steps);
+      }
+      loss_sum = LossStats{};
+      loss_steps = 0;
+    }
+    std::cout << "  [Train] buffer=" << buffer_.size() << " (" << buffer_.memory_bytes() / (1024 * 1024)
+              << " MB) | steps=" << steps << " | trained/inserted="
+              << static_cast<double>(trained.load()) /
+                     static_cast<double>(std::max(1LL, positions_played_.load() - positions_start))
+              << "\n";
+    std::cout << "  [Train] loss=" << losses.total << " (p=" << losses.policy << ", v=" << losses.value
+              << ")\n";
+
+    // Mismos seeds para los dos modelos, como en el loop serial.
+    const PredictionCache::Stats cache_eval_best = cache_.stats();
+    EvalMetrics eval_best = evaluate_model(best_model_, cfg_.eval_games, iter);
+    const std::string best_cache = cache_summary(cache_, cache_eval_best);
+    const PredictionCache::Stats cache_eval_new = cache_.stats();
+    EvalMetrics eval_new = evaluate_model(snapshot_model_, cfg_.eval_games, iter);
+    std::cout << "  [Eval best]      win=" << eval_best.win_rate
+              << " avg_len=" << eval_best.avg_length << best_cache << "\n";
+    std::cout << "  [Eval candidate] win=" << eval_new.win_rate
+              << " avg_len=" << eval_new.avg_length << cache_summary(cache_, cache_eval_new) << "\n";
+
+    if (eval_new.avg_length >= eval_best.avg_length) {
+      best_model_.copy_from(snapshot_model_);
+      best_win_rate_ = eval_new.win_rate;
+      std::cout << "  [Champion] actualizado (avg_len " << eval_best.avg_length
+                << " -> " << eval_new.avg_length << ")\n";
+    } else {
+      std::cout << "  [Champion] se mantiene (best=" << eval_best.avg_length
+                << " > candidate=" << eval_new.avg_length << ")\n";
+    }
+
+    checkpoint = std::thread([this, iter, &checkpoint_error, win_rate = best_win_rate_]() {
+      std::string err;
+      if (!save_checkpoint(iter, snapshot_model_, win_rate, err)) {
+        checkpoint_error = err;
+      }
+    });
+
+    const double secs =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - iter_start).count();
+    std::cout << "  [Pipeline] iteracion en " << std::fixed << std::setprecision(1) << secs << "s"
+              << std::defaultfloat << std::setprecision(6) << " | juegos=" << games_played_.load() - games_start
+              << "\n";
+  }
+
+  stop_learner.store(true);
+  learner.join();
+  stop_actors.store(true);
+  actors.join();
+  if (checkpoint.joinable()) {
+    checkpoint.join();
+  }
+  if (ok && !checkpoint_error.empty()) {
+    error = checkpoint_error;
+    ok = false;
+  }
+  if (ok) {
+    std::cout << "  [Checkpoint] guardado\n";
+  }
+  return ok;
+}
+
 }  // namespace alphasnake
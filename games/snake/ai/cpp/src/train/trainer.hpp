@@ -1,11 +1,15 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <string>
 #include <vector>
 
 #include "common/config.hpp"
+#include "env/snake_env.hpp"
 #include "model/policy_value_model.hpp"
+#include "model/prediction_cache.hpp"
+#include "train/batch_prefetcher.hpp"
 #include "train/replay_buffer.hpp"
 #include "train/types.hpp"
 
@@ -31,22 +35,50 @@ class AlphaSnakeTrainer {
 
   PolicyValueModel best_model_;
   PolicyValueModel candidate_model_;
+  // Compartido por best y candidate: las entradas van atadas a la versión de
+  // pesos, así que sobrevive a copy_from y se invalida solo al entrenar.
+  mutable PredictionCache cache_;
+
+  // Copia del candidato que evalúa el pipeline mientras el learner sigue
+  // entrenando candidate_model_ (solo con cfg.pipeline). Se construye con la
+  // arquitectura de la config para que copy_from no lo reinicialice (y
+  // resiembre torch) en mitad de la corrida.
+  PolicyValueModel snapshot_model_;
 
   int start_iteration_ = 0;
   float best_win_rate_ = 0.0f;
 
+  // Acumulados de self-play (los lee el coordinador del pipeline).
+  std::atomic<long long> games_played_{0};
+  std::atomic<long long> positions_played_{0};
+
   bool ensure_dirs(std::string& error) const;
   bool load_checkpoint(std::string& error);
-  bool save_checkpoint(int iteration, std::string& error) const;
+  bool save_checkpoint(int iteration,
+                       const PolicyValueModel& candidate,
+                       float best_win_rate,
+                       std::string& error) const;
+
+  // Modo cfg.pipeline: actores, learner y evaluador en paralelo.
+  bool run_pipelined(std::mt19937& rng, std::string& error);
 
-  std::vector<TrainingExample> run_self_play(int iteration);
-  using PredictFn = std::function<Prediction(const std::vector<float>&)>;
-  using BatchPredictFn = std::function<std::vector<Prediction>(const std::vector<std::vector<float>>&)>;
+  // Los juegos terminados van directo a buffer_ a medida que terminan;
+  // devuelven la cantidad de posiciones generadas.
+  // Con stop no hay tope de juegos: se juega contra best_model_ hasta que
+  // stop pase a true (actores del pipeline).
+  long long run_self_play(int iteration, const std::atomic<bool>* stop = nullptr);
+  // Variante con selfplay_games_per_thread > 0: varios juegos por hilo.
+  long long run_self_play_multiplexed(int iteration, const std::atomic<bool>* stop = nullptr);
+  using PredictFn = std::function<Prediction(const SnakeEnv&)>;
+  using BatchPredictFn = std::function<std::vector<Prediction>(const std::vector<const SnakeEnv*>&)>;
   std::vector<TrainingExample> play_single_game(PredictFn predict_fn,
                                                 BatchPredictFn batch_predict_fn,
                                                 uint32_t seed,
                                                 bool add_root_noise) const;
 
+  // Un paso de optimización de candidate_model_ sobre el próximo batch del
+  // prefetcher (con prioridades, también las actualiza).
+  LossStats train_step(BatchPrefetcher& loader, std::vector<float>& example_losses);
   LossStats train_candidate(std::mt19937& rng);
   EvalMetrics evaluate_model(const PolicyValueModel& model,
                              int games,
@@ -1,16 +1,25 @@
 #pragma once
 
 #include <array>
-#include <vector>
+
+#include "env/snake_env.hpp"
 
 namespace alphasnake {
 
 struct TrainingExample {
-  std::vector<float> state;
+  // Estado empaquetado (SnakeEnv::pack_state); SnakeEnv::decode_state da los
+  // 4xNxN floats que espera la red.
+  PackedState state;
+  // Todo en cero = sin objetivo de política (jugada con búsqueda rápida):
+  // el ejemplo solo entrena el value head.
   std::array<float, 4> policy{0.0f, 0.0f, 0.0f, 0.0f};
   float outcome = 0.0f;
 };
 
+inline bool has_policy_target(const std::array<float, 4>& policy) {
+  return policy[0] + policy[1] + policy[2] + policy[3] > 0.0f;
+}
+
 struct LossStats {
   float total = 0.0f;
   float policy = 0.0f;